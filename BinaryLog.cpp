@@ -0,0 +1,426 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "BinaryLog.hpp"
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::unordered_map;
+using std::ostream;
+using std::istream;
+using std::ifstream;
+using std::uint8_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::int64_t;
+
+/* Helpers for encoding/decoding integers and values */
+namespace detail
+{
+
+static constexpr char block_magic[4] = { 'M', 'B', 'L', 'K' };
+
+static constexpr size_t column_count = 5;
+
+enum ValueKind
+{
+	ONE,
+	INTEGER,
+	FLOAT,
+	ZERO
+};
+
+static void put_varint(string& out, uint64_t x)
+{
+	while (x >= 0x80) {
+		out.push_back(char(x | 0x80));
+		x >>= 7;
+	}
+	out.push_back(char(x));
+}
+
+static uint64_t zigzag(int64_t x)
+{
+	return (uint64_t(x) << 1) ^ uint64_t(x >> 63);
+}
+
+static int64_t unzigzag(uint64_t x)
+{
+	return int64_t(x >> 1) ^ -int64_t(x & 1);
+}
+
+static void put_string(string& out, const string_view& s)
+{
+	put_varint(out, s.size());
+	out.append(s);
+}
+
+/* Bounds-checked cursor over a byte buffer */
+struct Cursor
+{
+	const uint8_t *p;
+	const uint8_t *end;
+
+	Cursor(const string_view& sv) :
+		p(reinterpret_cast<const uint8_t *>(sv.data())),
+		end(p + sv.size()) { }
+
+	uint64_t varint()
+	{
+		uint64_t x = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			if (p == end) {
+				throw std::runtime_error("Truncated varint in binary event log");
+			}
+			uint8_t b = *p++;
+			x |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) {
+				return x;
+			}
+		}
+		throw std::runtime_error("Invalid varint in binary event log");
+	}
+
+	string_view bytes(size_t n)
+	{
+		if (size_t(end - p) < n) {
+			throw std::runtime_error("Truncated field in binary event log");
+		}
+		string_view sv(reinterpret_cast<const char *>(p), n);
+		p += n;
+		return sv;
+	}
+
+	string_view string()
+	{
+		return bytes(varint());
+	}
+
+	bool empty() const { return p == end; }
+};
+
+}
+
+
+namespace mugloar
+{
+
+bool is_binary_log(const string& filename)
+{
+	ifstream f(filename, std::ios::binary);
+	string magic(binary_log_magic.size(), '\0');
+	return f.read(magic.data(), magic.size()) && magic == binary_log_magic;
+}
+
+/* Writer */
+
+BinaryLogWriter::BinaryLogWriter(ostream& out, size_t block_events) :
+	out(out),
+	block_events(block_events)
+{
+	out.write(binary_log_magic.data(), binary_log_magic.size());
+}
+
+BinaryLogWriter::~BinaryLogWriter()
+{
+	flush();
+	out.flush();
+}
+
+uint32_t BinaryLogWriter::feature_id(const string& name)
+{
+	auto [it, is_new] = feature_ids.try_emplace(name, feature_ids.size());
+	if (is_new) {
+		detail::put_string(new_features, name);
+		++new_feature_count;
+	}
+	return it->second;
+}
+
+uint32_t BinaryLogWriter::cross_id(uint32_t bucket)
+{
+	auto it = cross_ids.find(bucket);
+	if (it != cross_ids.end()) {
+		return it->second;
+	}
+	/* Only materialise the name the first time that we see the bucket */
+	char name[32];
+	snprintf(name, sizeof(name), "%s%x", cross_feature_prefix, bucket);
+	auto id = feature_id(name);
+	cross_ids.emplace(bucket, id);
+	return id;
+}
+
+uint32_t BinaryLogWriter::game_id(const string& name)
+{
+	auto [it, is_new] = game_ids.try_emplace(name, game_ids.size());
+	if (is_new) {
+		detail::put_string(new_games, name);
+		++new_game_count;
+	}
+	return it->second;
+}
+
+void BinaryLogWriter::put_value(uint32_t id, float value)
+{
+	using namespace detail;
+	ValueKind kind;
+	if (value == 1.0f) {
+		kind = ONE;
+	} else if (value == 0.0f) {
+		kind = ZERO;
+	} else if (std::nearbyint(value) == value && std::fabs(value) < 2147483648.0f) {
+		kind = INTEGER;
+	} else {
+		kind = FLOAT;
+	}
+	put_varint(key_col, uint64_t(id) << 2 | kind);
+	switch (kind) {
+	case INTEGER:
+		put_varint(value_col, zigzag(int64_t(value)));
+		break;
+	case FLOAT: {
+		/* Assumes little-endian IEEE-754 host, as does everything else here */
+		char buf[sizeof(float)];
+		memcpy(buf, &value, sizeof(buf));
+		value_col.append(buf, sizeof(buf));
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void BinaryLogWriter::write(const string& game, uint64_t time, const unordered_map<string, float>& features, const CrossFeatures& cross)
+{
+	detail::put_varint(game_col, game_id(game));
+	detail::put_varint(time_col, detail::zigzag(int64_t(time - last_time)));
+	last_time = time;
+	detail::put_varint(count_col, features.size() + cross.size());
+	for (const auto& [name, value] : features) {
+		put_value(feature_id(name), value);
+	}
+	for (const auto& [bucket, value] : cross) {
+		put_value(cross_id(bucket), value);
+	}
+	if (++events >= block_events) {
+		flush();
+	}
+}
+
+void BinaryLogWriter::write(const string& game, uint64_t time, const FeatureList& features)
+{
+	detail::put_varint(game_col, game_id(game));
+	detail::put_varint(time_col, detail::zigzag(int64_t(time - last_time)));
+	last_time = time;
+	detail::put_varint(count_col, features.size());
+	for (const auto& [name, value] : features) {
+		put_value(feature_id(name), value);
+	}
+	if (++events >= block_events) {
+		flush();
+	}
+}
+
+void BinaryLogWriter::flush()
+{
+	using namespace detail;
+	if (events == 0) {
+		return;
+	}
+
+	string payload;
+	payload.reserve(new_features.size() + new_games.size() + game_col.size() + time_col.size() + count_col.size() + key_col.size() + value_col.size() + 64);
+
+	put_varint(payload, new_feature_count);
+	payload += new_features;
+	put_varint(payload, new_game_count);
+	payload += new_games;
+	put_varint(payload, events);
+	for (const auto *col : { &game_col, &time_col, &count_col, &key_col, &value_col }) {
+		put_varint(payload, col->size());
+	}
+	for (const auto *col : { &game_col, &time_col, &count_col, &key_col, &value_col }) {
+		payload += *col;
+	}
+
+	string header(block_magic, sizeof(block_magic));
+	put_varint(header, payload.size());
+	out.write(header.data(), header.size());
+	out.write(payload.data(), payload.size());
+
+	/* Reset pending block, keeping buffer capacity */
+	new_features.clear();
+	new_feature_count = 0;
+	new_games.clear();
+	new_game_count = 0;
+	events = 0;
+	/* Times are delta-coded within a block, the reader starts each block from zero */
+	last_time = 0;
+	for (auto *col : { &game_col, &time_col, &count_col, &key_col, &value_col }) {
+		col->clear();
+	}
+}
+
+/* Reader */
+
+void EventBlock::clear()
+{
+	game.clear();
+	time.clear();
+	offsets.clear();
+	features.clear();
+	values.clear();
+}
+
+BinaryLogReader::BinaryLogReader(istream& in) :
+	in(in)
+{
+}
+
+bool BinaryLogReader::next(EventBlock& block)
+{
+	using namespace detail;
+
+	block.clear();
+	_truncated = false;
+
+	/*
+	 * A block cut short by the end of the file is still being written (or
+	 * the writer died): it's treated as the end, and the stream is put back
+	 * to its start, so that next can be called again once there's more.
+	 */
+	const auto start = in.tellg();
+	auto truncated = [&] {
+		_truncated = true;
+		in.clear();
+		if (start != std::streampos(-1)) {
+			in.seekg(start);
+		}
+		return false;
+	};
+
+	/* Block magic, or a segment magic (which resets segment dictionaries) */
+	char magic[sizeof(block_magic)];
+	while (true) {
+		if (!in.read(magic, sizeof(magic))) {
+			if (in.gcount() == 0) {
+				in.clear();
+				return false;
+			}
+			return truncated();
+		}
+		if (memcmp(magic, block_magic, sizeof(magic)) == 0) {
+			break;
+		}
+		if (memcmp(magic, binary_log_magic.data(), sizeof(magic)) != 0) {
+			throw std::runtime_error("Invalid block header in binary event log");
+		}
+		char rest[binary_log_magic.size() - sizeof(magic)];
+		if (!in.read(rest, sizeof(rest))) {
+			return truncated();
+		}
+		if (memcmp(rest, binary_log_magic.data() + sizeof(magic), sizeof(rest)) != 0) {
+			throw std::runtime_error("Invalid block header in binary event log");
+		}
+		segment_features.clear();
+		segment_games.clear();
+	}
+
+	/* Payload size */
+	uint64_t size = 0;
+	for (unsigned shift = 0; ; shift += 7) {
+		int c = in.get();
+		if (c == EOF) {
+			return truncated();
+		}
+		if (shift >= 64) {
+			throw std::runtime_error("Invalid block size in binary event log");
+		}
+		size |= uint64_t(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			break;
+		}
+	}
+	payload.resize(size);
+	if (!in.read(payload.data(), size)) {
+		return truncated();
+	}
+
+	Cursor cur(payload);
+
+	/* Dictionaries */
+	for (auto n = cur.varint(); n > 0; --n) {
+		string name(cur.string());
+		auto [it, is_new] = feature_ids.try_emplace(name, _feature_names.size());
+		if (is_new) {
+			_feature_names.push_back(std::move(name));
+		}
+		segment_features.push_back(it->second);
+	}
+	for (auto n = cur.varint(); n > 0; --n) {
+		string name(cur.string());
+		auto [it, is_new] = game_ids.try_emplace(name, _game_names.size());
+		if (is_new) {
+			_game_names.push_back(std::move(name));
+		}
+		segment_games.push_back(it->second);
+	}
+
+	/* Columns */
+	const size_t events = cur.varint();
+	size_t sizes[column_count];
+	for (auto& s : sizes) {
+		s = cur.varint();
+	}
+	Cursor game_col(cur.bytes(sizes[0]));
+	Cursor time_col(cur.bytes(sizes[1]));
+	Cursor count_col(cur.bytes(sizes[2]));
+	Cursor key_col(cur.bytes(sizes[3]));
+	Cursor value_col(cur.bytes(sizes[4]));
+
+	block.game.reserve(events);
+	block.time.reserve(events);
+	block.offsets.reserve(events + 1);
+	block.offsets.push_back(0);
+
+	uint64_t time = 0;
+	for (size_t i = 0; i < events; ++i) {
+		const auto game = game_col.varint();
+		if (game >= segment_games.size()) {
+			throw std::runtime_error("Invalid game id in binary event log");
+		}
+		block.game.push_back(segment_games[game]);
+		time += unzigzag(time_col.varint());
+		block.time.push_back(time);
+		block.offsets.push_back(block.offsets.back() + count_col.varint());
+	}
+
+	const size_t total = block.offsets.back();
+	block.features.reserve(total);
+	block.values.reserve(total);
+	for (size_t i = 0; i < total; ++i) {
+		const auto key = key_col.varint();
+		const auto id = key >> 2;
+		if (id >= segment_features.size()) {
+			throw std::runtime_error("Invalid feature id in binary event log");
+		}
+		block.features.push_back(segment_features[id]);
+		float value;
+		switch (ValueKind(key & 3)) {
+		case ONE: value = 1.0f; break;
+		case ZERO: value = 0.0f; break;
+		case INTEGER: value = float(unzigzag(value_col.varint())); break;
+		case FLOAT: memcpy(&value, value_col.bytes(sizeof(value)).data(), sizeof(value)); break;
+		}
+		block.values.push_back(value);
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,166 @@
+#pragma once
+/*
+ * Binary, columnar, block-structured event log.
+ *
+ * The text event log repeats every feature name on every line, which makes it
+ * huge and slow to parse.  This format stores each distinct feature name and
+ * game id once, and the events as columns of small integers.
+ *
+ * File layout (a file is one or more concatenated segments, so appending to
+ * an existing file, or cat-ing two files together, just starts a new segment):
+ *
+ *   segment:  "MUGLOG1\n" block*
+ *
+ *   block:    u32 "MBLK", varint payload-size, payload
+ *
+ *   payload:  varint new-feature-count, (varint length, bytes)*
+ *             varint new-game-count, (varint length, bytes)*
+ *             varint event-count
+ *             varint size of each column (5 of them, in bytes)
+ *             columns:
+ *               game   varint game id, per event
+ *               time   zigzag varint microseconds since previous event of the block (first: since epoch)
+ *               count  varint number of features, per event
+ *               keys   varint (feature id << 2 | value kind), per feature
+ *               values value payload, per feature (size depends on kind)
+ *
+ * Feature and game ids are assigned in order of first appearance within the
+ * segment; each block carries the names which it introduces.
+ *
+ * Value kinds: 0 = 1.0 (no payload), 1 = integer (zigzag varint),
+ * 2 = float (4 bytes, little-endian), 3 = 0.0 (no payload).
+ *
+ * Nearly every value is an indicator (1.0) or a small integer, so a typical
+ * feature costs two or three bytes rather than the ~25 of a text key/value.
+ */
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ExtractFeatures.hpp"
+
+namespace mugloar
+{
+
+/* Magic string at start of each segment */
+constexpr std::string_view binary_log_magic = "MUGLOG1\n";
+
+/* Is the file a binary event log?  (checks magic string) */
+bool is_binary_log(const std::string& filename);
+
+/*
+ * Encodes events into blocks and writes them to a stream.
+ *
+ * Not thread-safe, see EventLog (LogEvent.hpp) for the shared writer used by
+ * the players.
+ */
+class BinaryLogWriter
+{
+	std::ostream& out;
+	size_t block_events;
+
+	/* Segment dictionaries */
+	std::unordered_map<std::string, std::uint32_t> feature_ids;
+	std::unordered_map<std::uint32_t, std::uint32_t> cross_ids;
+	std::unordered_map<std::string, std::uint32_t> game_ids;
+
+	/* Pending block */
+	std::string new_features;
+	std::uint32_t new_feature_count = 0;
+	std::string new_games;
+	std::uint32_t new_game_count = 0;
+	size_t events = 0;
+	std::uint64_t last_time = 0;
+	std::string game_col;
+	std::string time_col;
+	std::string count_col;
+	std::string key_col;
+	std::string value_col;
+
+	std::uint32_t feature_id(const std::string& name);
+	std::uint32_t cross_id(std::uint32_t bucket);
+	std::uint32_t game_id(const std::string& name);
+	void put_value(std::uint32_t id, float value);
+
+public:
+	/* Starts a new segment in the stream */
+	BinaryLogWriter(std::ostream& out, size_t block_events = 4096);
+
+	BinaryLogWriter(const BinaryLogWriter&) = delete;
+	BinaryLogWriter& operator = (const BinaryLogWriter&) = delete;
+
+	/* Flushes pending block */
+	~BinaryLogWriter();
+
+	/* Append an event (time in microseconds since epoch, or zero if unknown) */
+	void write(const std::string& game, std::uint64_t time, const std::unordered_map<std::string, float>& features, const CrossFeatures& cross = {});
+
+	void write(const std::string& game, std::uint64_t time, const FeatureList& features);
+
+	/* Write pending block to the stream (if any) */
+	void flush();
+};
+
+/* Decoded block of events, in compressed sparse row layout */
+struct EventBlock
+{
+	/* Per event */
+	std::vector<std::uint32_t> game;
+	std::vector<std::uint64_t> time;
+
+	/* Features of event i are [offsets[i], offsets[i + 1]) */
+	std::vector<std::uint32_t> offsets;
+
+	/* Per feature */
+	std::vector<std::uint32_t> features;
+	std::vector<float> values;
+
+	size_t size() const { return game.size(); }
+
+	void clear();
+};
+
+/*
+ * Reads blocks from a stream.
+ *
+ * Feature and game ids in the decoded blocks refer to the reader's own
+ * dictionaries, which span all segments of the file.
+ */
+class BinaryLogReader
+{
+	std::istream& in;
+	std::string payload;
+
+	std::vector<std::string> _feature_names;
+	std::unordered_map<std::string, std::uint32_t> feature_ids;
+	std::vector<std::string> _game_names;
+	std::unordered_map<std::string, std::uint32_t> game_ids;
+
+	/* Segment id -> reader id */
+	std::vector<std::uint32_t> segment_features;
+	std::vector<std::uint32_t> segment_games;
+
+	bool _truncated = false;
+
+public:
+	BinaryLogReader(std::istream& in);
+
+	/*
+	 * Read and decode next block, returns false at end of file.  A partly
+	 * written block at the end also counts as the end (see truncated()): the
+	 * stream is left at its start, so it can be read once it's complete.
+	 */
+	bool next(EventBlock& block);
+
+	/* Did the last call to next stop at a partly written block? */
+	bool truncated() const { return _truncated; }
+
+	const std::vector<std::string>& feature_names() const { return _feature_names; }
+	const std::vector<std::string>& game_names() const { return _game_names; }
+};
+
+}
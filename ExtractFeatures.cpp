@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "ExtractFeatures.hpp"
 #include "LowerCase.hpp"
 
@@ -6,6 +8,8 @@ using std::string_view;
 using std::vector;
 using std::unordered_map;
 using std::to_string;
+using std::uint32_t;
+using std::uint64_t;
 
 /* Helper functions for decomposing text strings to words */
 namespace detail
@@ -52,13 +56,35 @@ static void word_pairs_of(vector<string_view>& res, const string_view& sv)
 	}
 }
 
+/* FNV-1a, stable across builds and platforms unlike std::hash */
+static uint64_t hash_name(const string_view& name)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (unsigned char c : name) {
+		h = (h ^ c) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+/* Combine two name hashes into a cross-feature bucket */
+static uint32_t cross_bucket(uint64_t a, uint64_t b)
+{
+	/* splitmix64 finaliser */
+	uint64_t h = a ^ (b + 0x9e3779b97f4a7c15ull + (a << 6) + (a >> 2));
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+	h = h ^ (h >> 31);
+	return uint32_t(h >> (64 - mugloar::cross_feature_bits));
+}
+
 }
 
 
 namespace mugloar
 {
 
-void extract_action_features(unordered_map<string, float>& features, const string& type, const string& description)
+/* Build feature-set of an action, without touching the cache */
+static FeatureList make_action_features(const string& type, const string& description)
 {
 	vector<string_view> name_words;
 	name_words.reserve(1000);
@@ -69,33 +95,73 @@ void extract_action_features(unordered_map<string, float>& features, const strin
 	/* Get word pairs from description */
 	detail::word_pairs_of(name_words, description);
 
+	FeatureList features;
+	features.reserve(name_words.size() + 3);
+
 	/* Action type */
-	features["action:" + type] = 1;
+	features.emplace_back("action:" + type, 1);
 
 	/* Build feature set */
 	for (const auto& w : name_words) {
-		features[lowercase(string(w))] = 1;
+		features.emplace_back(lowercase(string(w)), 1);
 	}
+
+	/* Repeated words are a single feature, as they were in the feature map */
+	std::sort(features.begin(), features.end());
+	features.erase(std::unique(features.begin(), features.end()), features.end());
+
+	return features;
 }
 
-void extract_action_features(unordered_map<string, float>& features, const Message& message)
+/* Merge cached feature-set into feature map */
+static void merge_features(unordered_map<string, float>& features, const FeatureList& list)
 {
-	extract_action_features(features, "solve", message.message);
-
-	/* Cipher type */
-	if (message.cipher == PLAIN) {
-		features["cipher:none"] = 1;
-	} else {
-		features["cipher:" + to_string(int(message.cipher))] = 1;
+	for (const auto& [name, value] : list) {
+		features[name] = value;
 	}
+}
 
-	/* Probability */
-	features["probability:" + lowercase(message.probability)] = 1;
+void extract_action_features(unordered_map<string, float>& features, const string& type, const string& description)
+{
+	merge_features(features, make_action_features(type, description));
+}
+
+FeatureCache::Value action_features(const Message& message)
+{
+	/* Unit separator can't appear in the decoded message text */
+	const auto key = "solve\x1f" + message.message + "\x1f" + to_string(int(message.cipher)) + "\x1f" + message.probability;
+	return action_feature_cache().get(key, [&] () {
+		auto features = make_action_features("solve", message.message);
+
+		/* Cipher type */
+		if (message.cipher == PLAIN) {
+			features.emplace_back("cipher:none", 1);
+		} else {
+			features.emplace_back("cipher:" + to_string(int(message.cipher)), 1);
+		}
+
+		/* Probability */
+		features.emplace_back("probability:" + lowercase(message.probability), 1);
+
+		return features;
+	});
+}
+
+FeatureCache::Value action_features(const Item& item)
+{
+	return action_feature_cache().get("buy\x1f" + item.name, [&] () {
+		return make_action_features("buy", item.name);
+	});
+}
+
+void extract_action_features(unordered_map<string, float>& features, const Message& message)
+{
+	merge_features(features, *action_features(message));
 }
 
 void extract_action_features(unordered_map<string, float>& features, const Item& item)
 {
-	extract_action_features(features, "buy", item.name);
+	merge_features(features, *action_features(item));
 }
 
 void extract_game_state(std::unordered_map<std::string, float>& features, const GameState& state)
@@ -129,6 +195,37 @@ void extract_game_diff_state(std::unordered_map<std::string, float>& features, c
 	features["diff:rep_underworld"] = state_diff.rep_underworld;
 }
 
+CrossState::CrossState(const GameState& state)
+{
+	keys.reserve(2);
+	keys.push_back(detail::hash_name("lives:" + to_string(int(state.lives))));
+	keys.push_back(detail::hash_name("gold50:" + to_string(int(state.gold / 50) * 50)));
+}
+
+void extract_cross_features(CrossFeatures& cross, const CrossState& state, const FeatureList& action, size_t max_crosses)
+{
+	auto emit = [&] (bool categorical) {
+		for (const auto& [name, value] : action) {
+			if ((name.find(':') != string::npos) != categorical) {
+				continue;
+			}
+			const auto action_key = detail::hash_name(name);
+			for (const auto state_key : state.keys) {
+				if (cross.size() >= max_crosses) {
+					return;
+				}
+				cross.emplace_back(detail::cross_bucket(state_key, action_key), value);
+			}
+		}
+	};
+	cross.clear();
+	emit(true);
+	emit(false);
+	/* Colliding pairs share a bucket, keep one so it isn't counted twice */
+	std::sort(cross.begin(), cross.end());
+	cross.erase(std::unique(cross.begin(), cross.end(), [] (const auto& a, const auto& b) { return a.first == b.first; }), cross.end());
+}
+
 GameState::GameState(const Game& game) :
 	score(game.score()),
 	lives(game.lives()),
@@ -9,8 +9,10 @@
 #include <string>
 #include <vector>
 #include <tuple>
+#include <cstdint>
 
 #include "Game.hpp"
+#include "FeatureCache.hpp"
 
 namespace mugloar {
 
@@ -29,6 +31,14 @@ void extract_action_features(std::unordered_map<std::string, float>& features, c
 /* Helper function for extracting features from BUY action */
 void extract_action_features(std::unordered_map<std::string, float>& features, const Item& item);
 
+/*
+ * Cached feature-sets of SOLVE/BUY actions, keyed on (text, cipher,
+ * probability) and (item name) respectively.  The helpers above use these, so
+ * a repeated message costs one cache lookup instead of a re-tokenise.
+ */
+FeatureCache::Value action_features(const Message& message);
+FeatureCache::Value action_features(const Item& item);
+
 /* Partial change between game states */
 struct GameStateDiff
 {
@@ -72,4 +82,48 @@ void extract_game_state(std::unordered_map<std::string, float>& features, const
 /* Extract feature-set from game state diff */
 void extract_game_diff_state(std::unordered_map<std::string, float>& features, const GameStateDiff& state_diff);
 
+/*
+ * Hashed state x action interaction ("cross") features, e.g.
+ * "lives:1 x healing potion" or "gold50:150 x probability:gamble".
+ *
+ * The linear model scores state and action features independently, so it
+ * can't learn e.g. "buy a health potion when on the last life" without these.
+ *
+ * Each cross is identified by hashing the pair of feature names into one of
+ * 2^cross_feature_bits buckets, so no strings are built for them.  They appear
+ * in the event log and cost table as "x:<bucket in hex>".
+ */
+using CrossFeatures = std::vector<std::pair<std::uint32_t, float>>;
+
+constexpr unsigned cross_feature_bits = 20;
+
+constexpr auto cross_feature_prefix = "x:";
+
+/*
+ * Bookkeeping fields in the text event log, which aren't features and are
+ * ignored by the learner, e.g. "meta:time" (microseconds since epoch, written
+ * by the sharded logger so that shards can be merged in order).
+ */
+constexpr auto meta_prefix = "meta:";
+
+constexpr auto meta_time = "meta:time";
+
+/* Number of events that a sampled event stands for (see sampling in LogEvent.hpp) */
+constexpr auto meta_weight = "meta:weight";
+
+/* Hashes of the state features which take part in crosses (build once per turn) */
+struct CrossState
+{
+	std::vector<std::uint64_t> keys;
+
+	CrossState(const GameState& state);
+};
+
+/*
+ * Generate crosses of game state with an action's features, at most
+ * max_crosses of them (zero disables crosses).  Categorical action features
+ * (action type, cipher, probability) are crossed before words.
+ */
+void extract_cross_features(CrossFeatures& cross, const CrossState& state, const FeatureList& action, size_t max_crosses);
+
 }
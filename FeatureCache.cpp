@@ -0,0 +1,108 @@
+#include <algorithm>
+
+#include "FeatureCache.hpp"
+
+using std::string;
+using std::string_view;
+using std::function;
+using std::ostream;
+using std::scoped_lock;
+using std::make_shared;
+
+namespace mugloar
+{
+
+FeatureCache::FeatureCache(size_t capacity, size_t shard_count) :
+	shards(std::max<size_t>(shard_count, 1)),
+	shard_capacity(std::max<size_t>(capacity / shards.size(), 1))
+{
+	for (auto& shard : shards) {
+		shard.index.reserve(shard_capacity + 1);
+	}
+}
+
+FeatureCache::Shard& FeatureCache::shard_of(const string_view& key)
+{
+	return shards[std::hash<string_view>{}(key) % shards.size()];
+}
+
+FeatureCache::Value FeatureCache::get(const string& key, const function<FeatureList()>& make)
+{
+	auto& shard = shard_of(key);
+
+	/* Hit: move entry to front of LRU list */
+	{
+		scoped_lock lock(shard.mutex);
+		if (auto it = shard.index.find(key); it != shard.index.end()) {
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			++_hits;
+			return it->second->second;
+		}
+	}
+
+	/* Miss: extract features without holding the lock */
+	++_misses;
+	Value value = make_shared<const FeatureList>(make());
+
+	scoped_lock lock(shard.mutex);
+
+	/* Another worker may have inserted it while we were busy */
+	if (auto it = shard.index.find(key); it != shard.index.end()) {
+		return it->second->second;
+	}
+
+	shard.lru.emplace_front(key, value);
+	shard.index.emplace(shard.lru.front().first, shard.lru.begin());
+
+	/* Evict least-recently used entries */
+	while (shard.lru.size() > shard_capacity) {
+		shard.index.erase(shard.lru.back().first);
+		shard.lru.pop_back();
+		++_evictions;
+	}
+
+	return value;
+}
+
+void FeatureCache::clear()
+{
+	for (auto& shard : shards) {
+		scoped_lock lock(shard.mutex);
+		shard.index.clear();
+		shard.lru.clear();
+	}
+}
+
+size_t FeatureCache::size()
+{
+	size_t total = 0;
+	for (auto& shard : shards) {
+		scoped_lock lock(shard.mutex);
+		total += shard.lru.size();
+	}
+	return total;
+}
+
+double FeatureCache::hit_rate() const
+{
+	size_t h = _hits;
+	size_t m = _misses;
+	return h + m == 0 ? 0.0 : double(h) / double(h + m);
+}
+
+void FeatureCache::print_stats(ostream& os)
+{
+	os << "Feature cache: entries=" << size()
+		<< " hits=" << hits()
+		<< " misses=" << misses()
+		<< " evictions=" << evictions()
+		<< " hit-rate=" << (hit_rate() * 100) << "%";
+}
+
+FeatureCache& action_feature_cache()
+{
+	static FeatureCache cache;
+	return cache;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+/*
+ * Bounded, thread-safe cache of precomputed action feature-sets.
+ *
+ * Message texts come from a small set of templates, so nearly every action we
+ * see has already been tokenised and lowercased on some earlier turn (or in
+ * some other worker's game).  The cache is split into shards, each with its
+ * own lock and LRU list, so that workers rarely contend with each other.
+ */
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <functional>
+#include <ostream>
+
+namespace mugloar
+{
+
+/* Precomputed feature-set, as (name, value) pairs */
+using FeatureList = std::vector<std::pair<std::string, float>>;
+
+/* Sharded LRU mapping from key string to feature-set */
+class FeatureCache
+{
+public:
+	using Value = std::shared_ptr<const FeatureList>;
+
+private:
+	using Entry = std::pair<std::string, Value>;
+
+	struct Shard
+	{
+		std::mutex mutex;
+		/* Most-recently used at front */
+		std::list<Entry> lru;
+		/* Keys are views of the strings held in the LRU list nodes */
+		std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+	};
+
+	std::vector<Shard> shards;
+	size_t shard_capacity;
+
+	std::atomic<size_t> _hits { 0 };
+	std::atomic<size_t> _misses { 0 };
+	std::atomic<size_t> _evictions { 0 };
+
+	Shard& shard_of(const std::string_view& key);
+
+public:
+	/* Capacity is total number of entries, split evenly over the shards */
+	FeatureCache(size_t capacity = 4096, size_t shard_count = 16);
+
+	FeatureCache(const FeatureCache&) = delete;
+	FeatureCache& operator = (const FeatureCache&) = delete;
+
+	/* Look up key, calling make() outside of the lock on a miss */
+	Value get(const std::string& key, const std::function<FeatureList()>& make);
+
+	/* Drop all entries (statistics are kept) */
+	void clear();
+
+	/* Statistics */
+
+	size_t hits() const { return _hits; }
+	size_t misses() const { return _misses; }
+	size_t evictions() const { return _evictions; }
+	size_t size();
+	double hit_rate() const;
+
+	/* Print one-line summary of statistics */
+	void print_stats(std::ostream& os);
+};
+
+/* Cache used for action feature extraction (see ExtractFeatures.hpp) */
+FeatureCache& action_feature_cache();
+
+}
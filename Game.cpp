@@ -2,14 +2,21 @@
 #include <functional>
 #include <stdexcept>
 #include <limits>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <cstdlib>
+#include <string_view>
 
 #include "LowerCase.hpp"
 #include "Base64dec.hpp"
 #include "Rot13dec.hpp"
 #include "Game.hpp"
+#include "MappedFile.hpp"
 
 using std::function;
 using std::string;
+using std::string_view;
 using std::vector;
 using std::pair;
 using std::numeric_limits;
@@ -55,12 +62,18 @@ const string& reverse_lookup_probability(Probability p)
 	return prob_map[p].first;
 }
 
+/* Success probabilities fitted by mugfit, NaN where none was loaded */
+static vector<float> fitted_risk(prob_map.size(), numeric_limits<float>::quiet_NaN());
+
 /* Normalises in every call, inefficient!  But vs time for API calls, not noticeable */
 float probability_risk(Probability p)
 {
 	if (p < 0 || p >= prob_map.size()) {
 		throw std::runtime_error("Invalid probability value");
 	}
+	if (!std::isnan(fitted_risk[p])) {
+		return fitted_risk[p];
+	}
 	/* Find min/max risk */
 	float m = numeric_limits<float>::infinity();
 	float M = -numeric_limits<float>::infinity();
@@ -74,6 +87,38 @@ float probability_risk(Probability p)
 	return (r - m) / (M - m);
 }
 
+/*
+ * Table written by mugfit: one "probability\tp\tlow\thigh\ttrials\tname\t"
+ * line per probability, among lines for the model's other parameters.  The
+ * fitted success probability (at level + bias = turn) is used as the risk
+ * as it is, not normalised like the built-in values, which are on a cost
+ * scale: BasicAssist weighs the cost of healing by (1 - risk), so the risk
+ * should be the chance of success.  Probabilities which the table lacks (no
+ * solve events in the log it was fitted from) keep their built-in value.
+ */
+void load_probability_risk(const string& filename)
+{
+	const MappedFile file(filename);
+	vector<float> risks(prob_map.size(), numeric_limits<float>::quiet_NaN());
+	vector<string_view> fields;
+	for_each_line(file.view(), [&] (const string_view& line) {
+		fields.clear();
+		for_each_field(line, [&] (const string_view& field) { fields.push_back(field); });
+		if (fields.size() < 6 || fields[0] != "probability") {
+			return;
+		}
+		const auto p = lookup_probability(string(fields[5]));
+		/* Fields are tab-terminated, which stops strtof */
+		risks[p] = std::clamp(std::strtof(fields[1].data(), nullptr), 0.0f, 1.0f);
+	});
+	for (size_t p = 0; p < prob_map.size(); ++p) {
+		if (std::isnan(risks[p])) {
+			std::cerr << "No risk for probability \"" << prob_map[p].first << "\" in " << filename << ", using the built-in value" << std::endl;
+		}
+	}
+	fitted_risk = std::move(risks);
+}
+
 Game::Game(const Api& api, const optional<GameId>& id) :
 	api(api)
 {
@@ -81,6 +126,7 @@ Game::Game(const Api& api, const optional<GameId>& id) :
 		_id = *id;
 		_lives = 1;
 	} else {
+		++_api_calls;
 		api.game_start(_id, _lives, _gold, _level, _score, _high_score, _turn);
 	}
 	autoupdate_reputation = false;
@@ -104,6 +150,7 @@ void Game::turn_started()
 /* Updates reputation (which costs a turn) but does call turn_started after */
 void Game::internal_update_reputation()
 {
+	++_api_calls;
 	api.investigate_reputation(_id, _people_rep, _state_rep, _underworld_rep);
 	_turn = _turn + 1;
 }
@@ -118,6 +165,7 @@ void Game::update_reputation()
 void Game::update_messages()
 {
 	_messages.clear();
+	++_api_calls;
 	api.get_messages(_id, [this] (AdId ad_id, String message, Number reward, Number expires_in, String probability, Format format) {
 		function<string(const string&)> decoder = nullptr;
 		switch (format) {
@@ -142,6 +190,7 @@ void Game::update_messages()
 void Game::update_items()
 {
 	_shop_items.clear();
+	++_api_calls;
 	api.shop_list_items(_id, [this] (ItemId item_id, String name, Number cost) {
 		_shop_items.push_back({
 			std::move(item_id),
@@ -155,6 +204,7 @@ pair<bool, String> Game::solve_message(const Message& message)
 {
 	bool success;
 	String explanation;
+	++_api_calls;
 	api.solve_message(_id, message.id, success, _lives, _gold, _score, _high_score, _turn, explanation);
 	turn_started();
 	return std::make_pair(success, std::move(explanation));
@@ -163,6 +213,7 @@ pair<bool, String> Game::solve_message(const Message& message)
 bool Game::purchase_item(const Item& item)
 {
 	bool success;
+	++_api_calls;
 	api.shop_buy_item(_id, item.id, success, _gold, _lives, _level, _turn);
 	if (success) {
 		_own_items.try_emplace(item, 0).first->second++;
@@ -110,6 +110,14 @@ const std::string& reverse_lookup_probability(Probability p);
 /* Risk factor for probability (0=suicide, 1=safe) [Values obtained via ML] */
 float probability_risk(Probability p);
 
+/*
+ * Use the success probabilities fitted by mugfit as risk factors, instead of
+ * the built-in values (call at startup, before any games are played).
+ * Probabilities missing from the table keep their built-in value, with a
+ * warning.
+ */
+void load_probability_risk(const std::string& filename);
+
 /* Main class for a game instance */
 class Game
 {
@@ -127,6 +135,9 @@ class Game
 	Number _state_rep = 0;
 	Number _underworld_rep = 0;
 
+	/* Number of API requests made for this game */
+	unsigned _api_calls = 0;
+
 	std::vector<Message> _messages;
 
 	std::vector<Item> _shop_items;
@@ -162,6 +173,8 @@ public:
 	Number state_rep() const { return _state_rep; }
 	Number underworld_rep() const { return _underworld_rep; }
 
+	unsigned api_calls() const { return _api_calls; }
+
 	const std::vector<Message>& messages() const { return _messages; }
 
 	const std::vector<Item>& shop_items() const { return _shop_items; }
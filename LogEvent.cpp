@@ -1,36 +1,586 @@
-#include <mutex>
+#include <cstdio>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "LogEvent.hpp"
+#include "BinaryLog.hpp"
+#include "TrajectoryIndex.hpp"
+#include "Parallel.hpp"
 
 using std::unordered_map;
 using std::string;
-using std::ostream;
+using std::vector;
+using std::ostringstream;
+using std::atomic;
 using std::mutex;
 using std::scoped_lock;
+using std::unique_ptr;
+using std::make_unique;
+using std::pair;
+using std::to_string;
+using std::string_view;
+using std::mt19937_64;
+using std::random_device;
 using std::endl;
 using std::cerr;
+using std::uint64_t;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
 
 namespace mugloar
 {
 
-/* Emit event features to log file */
-void log_event(ostream& f, const Game& game, const unordered_map<string, float>& entry)
+/* Event waiting in a worker's queue */
+struct EventLog::Event
 {
-	static mutex io_mutex;
-	static size_t count = 0;
-	scoped_lock lock(io_mutex);
+	steady_clock::time_point logged_at;
+
+	/* Binary log: structured event, microseconds since epoch */
+	string game;
+	uint64_t time;
+	unordered_map<string, float> features;
+	CrossFeatures cross;
+
+	/* Text log: line formatted by the worker */
+	string line;
+};
 
-	f << game.id() << "\t";
+/*
+ * Write buffer from offset done to the end, retrying on partial writes.  done
+ * is kept up to date, so that a failed write can be resumed without writing
+ * anything twice.
+ */
+static void write_all(int fd, const string& data, size_t& done)
+{
+	while (done < data.size()) {
+		auto res = ::write(fd, data.data() + done, data.size() - done);
+		if (res == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error(string("Failed to write event log: ") + strerror(errno));
+		}
+		done += res;
+	}
+}
 
+static void sync_log(int fd, const string& filename)
+{
+	if (fdatasync(fd) == -1) {
+		throw std::runtime_error("Failed to sync event log " + filename + ": " + strerror(errno));
+	}
+}
+
+/* Format features of an event as the rest of a text log line (after game id and bookkeeping fields) */
+static void format_features(ostringstream& f, const unordered_map<string, float>& entry, const CrossFeatures& cross)
+{
 	for (const auto& [key, value] : entry) {
 		f << key << "\t" << value << "\t";
 	}
-	f << endl;
+	for (const auto& [bucket, value] : cross) {
+		f << cross_feature_prefix << std::hex << bucket << std::dec << "\t" << value << "\t";
+	}
+	f << "\n";
+}
+
+/* Output file and pending batch, only touched by the writer thread (after construction) */
+struct EventLog::Output
+{
+	const string filename;
+	const bool indexed;
+	int fd = -1;
+
+	ostringstream binary_batch;
+	unique_ptr<BinaryLogWriter> binary;
+	string batch;
+	/* Bytes of batch already written, by a commit which then failed */
+	size_t batch_written = 0;
+
+	unique_ptr<IndexWriter> index;
+
+	Output(const string& filename, bool binary, bool indexed) :
+		filename(filename),
+		indexed(indexed)
+	{
+		/* Appending would leave a file that neither reader can read */
+		struct stat st;
+		if (stat(filename.c_str(), &st) == 0 && st.st_size > 0 && is_binary_log(filename) != binary) {
+			throw std::runtime_error("Event log " + filename + " is a " + (binary ? "text" : "binary") + " log, can't append " + (binary ? "binary" : "text") + " events to it");
+		}
+		if (binary) {
+			this->binary = make_unique<BinaryLogWriter>(binary_batch);
+		}
+	}
+
+	~Output()
+	{
+		if (fd != -1) {
+			close(fd);
+		}
+	}
+
+	void open()
+	{
+		if (fd != -1) {
+			return;
+		}
+		fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd == -1) {
+			throw std::runtime_error("Failed to open event log " + filename + ": " + strerror(errno));
+		}
+		if (indexed) {
+			index = make_unique<IndexWriter>(filename);
+			/* Catch up with whatever was logged before */
+			index->update();
+		}
+	}
+
+	void add(Event& event)
+	{
+		if (binary) {
+			binary->write(event.game, event.time, event.features, event.cross);
+		} else {
+			batch += event.line;
+		}
+	}
+
+	/*
+	 * Write pending batch (closing the binary segment if last).  Binary events
+	 * are only written once their block is full (or at the last commit), so
+	 * that blocks are big enough for their columns and dictionaries to pay
+	 * off, rather than one tiny block per commit.  If the write fails, the
+	 * batch is kept, and the next commit carries on where it left off.
+	 */
+	void commit(Durability durability, bool last)
+	{
+		if (binary) {
+			if (last) {
+				/* Writes the pending block */
+				binary.reset();
+			}
+			batch += binary_batch.str();
+			binary_batch.str(string());
+		}
+		if (batch.empty()) {
+			return;
+		}
+		open();
+		write_all(fd, batch, batch_written);
+		batch.clear();
+		batch_written = 0;
+		/* After the batch is done with, so that a sync or indexing failure can't cause it to be written twice */
+		if (durability == Durability::SYNC) {
+			sync_log(fd, filename);
+		}
+		if (index) {
+			index->update();
+		}
+	}
+};
+
+/* Single-producer (worker), single-consumer (writer thread) ring buffer */
+struct EventLog::Queue
+{
+	vector<Event> slots;
+	const size_t mask;
+
+	/* Next slot to read (owned by writer thread) */
+	alignas(64) atomic<size_t> head { 0 };
+	/* Next slot to write (owned by worker) */
+	alignas(64) atomic<size_t> tail { 0 };
+
+	/* This worker's shard (sharded mode only) */
+	unique_ptr<Output> shard;
+
+	static size_t round_up(size_t n)
+	{
+		size_t p = 1;
+		while (p < n) {
+			p <<= 1;
+		}
+		return p;
+	}
+
+	Queue(size_t capacity) :
+		slots(round_up(capacity)),
+		mask(slots.size() - 1)
+	{
+	}
+
+	/* Returns false (without blocking) if the queue is full */
+	bool push(Event&& event)
+	{
+		const auto t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) > mask) {
+			return false;
+		}
+		slots[t & mask] = std::move(event);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	template <typename Func>
+	void drain(Func func)
+	{
+		auto h = head.load(std::memory_order_relaxed);
+		const auto t = tail.load(std::memory_order_acquire);
+		for (; h != t; ++h) {
+			func(slots[h & mask]);
+		}
+		head.store(h, std::memory_order_release);
+	}
+};
+
+/* Reservoir per stratum (Vitter's algorithm R), locked in stripes so that workers rarely contend */
+struct EventLog::Sample
+{
+	struct Reservoir
+	{
+		vector<Event> events;
+		/* Events offered so far */
+		size_t seen = 0;
+	};
+
+	struct Stripe
+	{
+		mutex lock;
+		mt19937_64 prng { random_device()() };
+		unordered_map<string, Reservoir> strata;
+	};
+
+	static constexpr size_t stripe_count = 16;
+
+	const size_t capacity;
+	const unsigned turn_bucket;
+	Stripe stripes[stripe_count];
+
+	Sample(size_t capacity, unsigned turn_bucket) :
+		capacity(capacity),
+		turn_bucket(std::max(1u, turn_bucket))
+	{
+	}
+
+	/* Stratum of an event: action type, probability and turn bucket */
+	string stratum_of(const unordered_map<string, float>& entry) const
+	{
+		static const string_view action_prefix = "action:";
+		static const string_view probability_prefix = "probability:";
+		string_view action = "-";
+		string_view probability = "-";
+		for (const auto& [key, value] : entry) {
+			const string_view k(key);
+			if (k.substr(0, action_prefix.size()) == action_prefix) {
+				action = k;
+			} else if (k.substr(0, probability_prefix.size()) == probability_prefix) {
+				probability = k;
+			}
+		}
+		auto it = entry.find("game:turn");
+		const unsigned turn = it == entry.end() ? 0 : unsigned(it->second) / turn_bucket * turn_bucket;
+		string stratum;
+		stratum.reserve(action.size() + probability.size() + 8);
+		stratum.append(action).append("\t").append(probability).append("\t").append(to_string(turn));
+		return stratum;
+	}
+
+	void offer(const string& stratum, Event&& event)
+	{
+		auto& stripe = stripes[std::hash<string>()(stratum) % stripe_count];
+		scoped_lock lock(stripe.lock);
+		auto& reservoir = stripe.strata[stratum];
+		++reservoir.seen;
+		if (reservoir.events.size() < capacity) {
+			reservoir.events.push_back(std::move(event));
+			return;
+		}
+		/* Replace a random element with probability capacity/seen */
+		const auto j = std::uniform_int_distribution<size_t>(0, reservoir.seen - 1)(stripe.prng);
+		if (j < capacity) {
+			reservoir.events[j] = std::move(event);
+		}
+	}
 
-	++count;
-	if (count % 100 == 0) {
-		cerr << "Logged " << count << " entries" << endl;
+	/* Call func(event, weight) for each sampled event, returns number of strata */
+	template <typename Func>
+	size_t for_each(Func func)
+	{
+		size_t strata = 0;
+		for (auto& stripe : stripes) {
+			scoped_lock lock(stripe.lock);
+			for (const auto& [stratum, reservoir] : stripe.strata) {
+				/* Each sampled event stands for seen/sampled events of its stratum */
+				const float weight = float(reservoir.seen) / reservoir.events.size();
+				for (const auto& event : reservoir.events) {
+					func(event, weight);
+				}
+			}
+			strata += stripe.strata.size();
+		}
+		return strata;
 	}
+};
+
+Durability parse_durability(const string& name)
+{
+	if (name == "write") {
+		return Durability::WRITE;
+	} else if (name == "sync") {
+		return Durability::SYNC;
+	}
+	throw std::runtime_error("Invalid durability: " + name);
+}
+
+/* Distinguishes logs in the per-thread queue lookup, even if one is freed and another allocated at the same address */
+static atomic<unsigned> next_instance { 0 };
+
+EventLog::EventLog(const string& filename, const Options& options) :
+	options(options),
+	instance(next_instance++),
+	path(filename)
+{
+	if (options.index && options.binary) {
+		throw std::runtime_error("Trajectory index is only supported for text event logs");
+	}
+	if (options.sample_size > 0) {
+		if (options.sharded || options.index) {
+			throw std::runtime_error("Sampled event log can't be sharded or indexed");
+		}
+		/* The sample file is rewritten as a whole, don't clobber a previous log */
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0 && st.st_size > 0) {
+			throw std::runtime_error("Event log " + path + " already exists (a sampled log is written from scratch)");
+		}
+		sample = make_unique<Sample>(options.sample_size, options.sample_turn_bucket);
+	} else if (options.sharded) {
+		if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) {
+			throw std::runtime_error("Failed to create shard directory " + path + ": " + strerror(errno));
+		}
+	} else {
+		shared = make_unique<Output>(path, options.binary, options.index);
+		shared->open();
+	}
+	writer = std::thread([this] () { writer_task(); });
+}
+
+EventLog::~EventLog()
+{
+	closing = true;
+	writer.join();
+	cerr << "Logged " << written << " entries (dropped " << dropped << ", late " << late << ")" << endl;
+}
+
+EventLog::Queue& EventLog::queue_for_this_thread()
+{
+	thread_local vector<pair<unsigned, Queue *>> cache;
+	for (const auto& [id, queue] : cache) {
+		if (id == instance) {
+			return *queue;
+		}
+	}
+	/* First event from this thread: register a queue for it (file is opened by writer thread) */
+	auto queue = make_unique<Queue>(options.queue_capacity);
+	if (options.sharded) {
+		const auto id = worker_id >= 0 ? to_string(worker_id) : "main";
+		queue->shard = make_unique<Output>(path + "/events." + id + (options.binary ? ".mlog" : ".dat"), options.binary, options.index);
+	}
+	scoped_lock lock(queues_mutex);
+	queues.push_back(std::move(queue));
+	cache.emplace_back(instance, queues.back().get());
+	return *queues.back();
+}
+
+void EventLog::write(const Game& game, const unordered_map<string, float>& entry, const CrossFeatures& cross)
+{
+	Event event;
+	event.logged_at = steady_clock::now();
+
+	if (sample) {
+		/* Kept structured (and formatted when the sample is written), as its weight isn't known yet */
+		event.game = game.id();
+		event.time = std::chrono::duration_cast<std::chrono::microseconds>(system_clock::now().time_since_epoch()).count();
+		event.features = entry;
+		event.cross = cross;
+		sample->offer(sample->stratum_of(entry), std::move(event));
+		++logged;
+		return;
+	}
+
+	if (options.binary) {
+		event.game = game.id();
+		event.time = std::chrono::duration_cast<std::chrono::microseconds>(system_clock::now().time_since_epoch()).count();
+		event.features = entry;
+		event.cross = cross;
+	} else {
+		/* Format outside of any lock, in this worker's thread */
+		thread_local ostringstream f;
+		f.str(string());
+		f << game.id() << "\t";
+		if (options.sharded) {
+			/* Timestamp, so that shards can be merged in order */
+			f << meta_time << "\t" << std::chrono::duration_cast<std::chrono::microseconds>(system_clock::now().time_since_epoch()).count() << "\t";
+		}
+		format_features(f, entry, cross);
+		event.line = f.str();
+	}
+
+	if (queue_for_this_thread().push(std::move(event))) {
+		++logged;
+	} else {
+		++dropped;
+	}
+}
+
+/* Replace the log file with the current sample */
+void EventLog::write_sample()
+{
+	string data;
+	size_t events = 0;
+	size_t strata;
+	if (options.binary) {
+		ostringstream out;
+		{
+			BinaryLogWriter writer(out);
+			strata = sample->for_each([&] (const Event& event, float weight) {
+				auto features = event.features;
+				features[meta_weight] = weight;
+				writer.write(event.game, event.time, features, event.cross);
+				++events;
+			});
+		}
+		data = out.str();
+	} else {
+		ostringstream f;
+		strata = sample->for_each([&] (const Event& event, float weight) {
+			f << event.game << "\t" << meta_weight << "\t" << weight << "\t";
+			format_features(f, event.features, event.cross);
+			++events;
+		});
+		data = f.str();
+	}
+
+	/* Write a new file and rename it over the old one, so the log is always whole */
+	const auto tmp = path + ".tmp";
+	const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open event log " + tmp + ": " + strerror(errno));
+	}
+	try {
+		size_t done = 0;
+		write_all(fd, data, done);
+		if (options.durability == Durability::SYNC) {
+			sync_log(fd, tmp);
+		}
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+	close(fd);
+	if (rename(tmp.c_str(), path.c_str()) == -1) {
+		throw std::runtime_error("Failed to replace event log " + path + ": " + strerror(errno));
+	}
+	written = events;
+
+	cerr << "Sampled " << logged << " entries: kept " << events << " in " << strata << " strata" << endl;
+}
+
+void EventLog::writer_task()
+{
+	vector<Queue *> snapshot;
+	size_t reported = 0;
+	size_t reported_dropped = 0;
+
+	/* Sampled mode: only rewrite the sample every so often (and when closing) */
+	if (sample) {
+		auto next = steady_clock::now() + options.sample_interval;
+		bool last = false;
+		while (!last) {
+			last = closing;
+			if (last || steady_clock::now() >= next) {
+				try {
+					write_sample();
+				} catch (const std::runtime_error& e) {
+					cerr << e.what() << endl;
+				}
+				next = steady_clock::now() + options.sample_interval;
+			}
+			if (!last) {
+				std::this_thread::sleep_for(options.commit_interval);
+			}
+		}
+		return;
+	}
+
+	bool last = false;
+	while (!last) {
+		/* Check before draining, so the final pass sees every event */
+		last = closing;
+
+		{
+			scoped_lock lock(queues_mutex);
+			snapshot.clear();
+			for (const auto& queue : queues) {
+				snapshot.push_back(queue.get());
+			}
+		}
+
+		/* Gather one group commit from all queues */
+		const auto now = steady_clock::now();
+		for (auto *queue : snapshot) {
+			auto& output = queue->shard ? *queue->shard : *shared;
+			queue->drain([&] (Event& event) {
+				output.add(event);
+				if (now - event.logged_at > options.late_threshold) {
+					++late;
+				}
+				++written;
+			});
+		}
+
+		/* Commit it */
+		auto commit = [&] (Output& output) {
+			try {
+				output.commit(options.durability, last);
+			} catch (const std::runtime_error& e) {
+				cerr << e.what() << endl;
+			}
+		};
+		if (shared) {
+			commit(*shared);
+		}
+		for (auto *queue : snapshot) {
+			if (queue->shard) {
+				commit(*queue->shard);
+			}
+		}
+
+		/* Progress, and backpressure report */
+		if (written / 100 != reported / 100 || dropped != reported_dropped) {
+			cerr << "Logged " << written << " entries";
+			if (dropped || late) {
+				cerr << " (dropped " << dropped << ", late " << late << ")";
+			}
+			cerr << endl;
+			reported = written;
+			reported_dropped = dropped;
+		}
+
+		if (!last) {
+			std::this_thread::sleep_for(options.commit_interval);
+		}
+	}
+}
+
+void log_event(EventLog& log, const Game& game, const unordered_map<string, float>& entry, const CrossFeatures& cross)
+{
+	log.write(game, entry, cross);
 }
 
 }
@@ -4,17 +4,134 @@
  * in order to understand what works and what doesn't wokr (tactically).
  *
  * This log file is used by the machine-learning player's learner program.
+ *
+ * Workers never wait on the disk (or on each other): each worker thread pushes
+ * its events into its own lock-free queue, and a background writer thread
+ * drains all queues and writes them out in batches ("group commit").  If a
+ * queue is full, the event is dropped and counted instead of blocking.  Binary
+ * logs are written a whole block at a time instead, so the last (partial)
+ * block only reaches the file when the log is closed.
+ *
+ * In sharded mode, the output path is a directory and each worker's events go
+ * to a segment file of their own (events.<worker-id>.dat or .mlog), so workers
+ * share nothing at all.  Shards are merged into one log with mugmerge, and
+ * muglearn can read a shard directory directly.
+ *
+ * Text logs can also keep a trajectory index (see TrajectoryIndex.hpp) up to
+ * date, by indexing each batch right after it has been written.
+ *
+ * In sampled mode, the log holds a bounded, stratified sample of the events
+ * instead of all of them: a reservoir of fixed size is kept per (action type,
+ * probability, turn bucket), so that the rare late-game events aren't swamped
+ * by early-game ones.  The file is rewritten with the current sample every so
+ * often, and each event carries "meta:weight", the number of events that it
+ * stands for, which the learner uses to correct for the sampling.
  */
-#include <ostream>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 #include "Game.hpp"
+#include "ExtractFeatures.hpp"
 
 namespace mugloar
 {
 
-/* Emit event features to log file */
-void log_event(std::ostream& f, const Game& game, const std::unordered_map<std::string, float>& entry);
+/* How hard to try to get each batch onto the disk */
+enum class Durability
+{
+	/* One write() per batch, the OS decides when it reaches the disk */
+	WRITE,
+	/* Also fdatasync() after every batch (binary logs: of the complete blocks written so far) */
+	SYNC
+};
+
+/* Parse durability name ("write" or "sync") */
+Durability parse_durability(const std::string& name);
+
+/* Event log file shared by all workers, in text (TSV) or binary format */
+class EventLog
+{
+public:
+	struct Event;
+	struct Queue;
+	struct Output;
+	struct Sample;
+
+	struct Options
+	{
+		bool binary = false;
+		/* Write a shard per worker, into the directory given as filename */
+		bool sharded = false;
+		Durability durability = Durability::WRITE;
+		/* Keep a trajectory index alongside each (text) log file */
+		bool index = false;
+		/* Interval between group commits */
+		std::chrono::milliseconds commit_interval { 20 };
+		/* Capacity of each worker's queue (rounded up to a power of two) */
+		size_t queue_capacity = 4096;
+		/* Events written later than this after being logged are "late" */
+		std::chrono::milliseconds late_threshold { 1000 };
+		/* Keep only a sample of this many events per stratum (0 = log every event) */
+		size_t sample_size = 0;
+		/* Width of the turn buckets of sample strata */
+		unsigned sample_turn_bucket = 10;
+		/* Interval between rewrites of the sample file */
+		std::chrono::seconds sample_interval { 30 };
+	};
+
+private:
+	const Options options;
+	const unsigned instance;
+	const std::string path;
+
+	/* Output shared by all workers (unless sharded) */
+	std::unique_ptr<Output> shared;
+
+	/* Stratified sample (sampled mode only) */
+	std::unique_ptr<Sample> sample;
+
+	/* Worker queues, registered by each thread on its first event */
+	std::mutex queues_mutex;
+	std::vector<std::unique_ptr<Queue>> queues;
+
+	std::atomic<bool> closing { false };
+	std::thread writer;
+
+	std::atomic<size_t> logged { 0 };
+	std::atomic<size_t> dropped { 0 };
+	size_t written = 0;
+	size_t late = 0;
+
+	Queue& queue_for_this_thread();
+	void writer_task();
+	void write_sample();
+
+public:
+	/* Opens file (or shard directory) for appending, starts writer thread */
+	EventLog(const std::string& filename, const Options& options);
+	EventLog(const std::string& filename) : EventLog(filename, Options()) { }
+
+	EventLog(const EventLog&) = delete;
+	EventLog& operator = (const EventLog&) = delete;
+
+	/* Drains all queues, stops writer thread and closes files */
+	~EventLog();
+
+	/* Queue an event for writing (never blocks) */
+	void write(const Game& game, const std::unordered_map<std::string, float>& entry, const CrossFeatures& cross);
+
+	/* Statistics */
+	size_t events_logged() const { return logged; }
+	size_t events_dropped() const { return dropped; }
+};
+
+/* Emit event features (and hashed cross features, if any) to log file */
+void log_event(EventLog& log, const Game& game, const std::unordered_map<std::string, float>& entry, const CrossFeatures& cross = {});
 
 }
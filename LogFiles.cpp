@@ -0,0 +1,35 @@
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+#include "LogFiles.hpp"
+
+using std::string;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace mugloar
+{
+
+vector<string> log_files(const string& path)
+{
+	if (!fs::is_directory(path)) {
+		if (!fs::exists(path)) {
+			throw std::runtime_error("Event log not found: " + path);
+		}
+		return { path };
+	}
+	vector<string> files;
+	for (const auto& entry : fs::directory_iterator(path)) {
+		const auto name = entry.path().filename().string();
+		/* Skip hidden files, and trajectory indexes living alongside the shards */
+		if (entry.is_regular_file() && name[0] != '.' && entry.path().extension() != ".idx") {
+			files.push_back(entry.path().string());
+		}
+	}
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+/*
+ * Event log paths may name a single log file, or a directory of per-worker
+ * shards (see EventLog in LogEvent.hpp).
+ */
+#include <string>
+#include <vector>
+
+namespace mugloar
+{
+
+/* Files making up the log at path (the path itself, or the shards within it, sorted by name, excluding indexes) */
+std::vector<std::string> log_files(const std::string& path);
+
+}
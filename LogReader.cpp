@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include "LogReader.hpp"
+#include "LogFiles.hpp"
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::pair;
+using std::ifstream;
+using std::uint8_t;
+using std::uint64_t;
+using std::cerr;
+using std::endl;
+
+namespace fs = std::filesystem;
+
+namespace mugloar
+{
+
+LogReader::LogReader(const string& path)
+{
+	for (const auto& file : log_files(path)) {
+		if (is_binary_log(file)) {
+			cerr << "Reading binary file " << file << "..." << endl;
+			ifstream f(file, std::ios::binary);
+			BinaryLogReader reader(f);
+			auto& out = binary_files.emplace_back();
+			EventBlock block;
+			while (reader.next(block)) {
+				out.blocks.push_back(std::move(block));
+			}
+			if (reader.truncated()) {
+				cerr << "Ignoring partly written block at end of " << file << endl;
+			}
+			out.names = reader.feature_names();
+			out.games = reader.game_names();
+			binary_names.push_back(file);
+		} else {
+			cerr << "Mapping file " << file << "..." << endl;
+			text_files.emplace_back(file);
+			text_names.push_back(file);
+		}
+	}
+}
+
+size_t LogReader::text_size() const
+{
+	size_t size = 0;
+	for (const auto& file : text_files) {
+		size += file.size();
+	}
+	return size;
+}
+
+vector<LogChunk> LogReader::split(size_t count, const vector<pair<size_t, size_t>>& text_ranges, const vector<pair<size_t, size_t>>& binary_ranges) const
+{
+	vector<LogChunk> res;
+
+	/* Text: split each file at newlines, aiming for equal sizes across all files */
+	size_t total = 0;
+	for (const auto& [begin, end] : text_ranges) {
+		total += end - begin;
+	}
+	const size_t target = std::max<size_t>(total / std::max<size_t>(count, 1), 1);
+	for (size_t i = 0; i < text_files.size(); ++i) {
+		const auto& [begin, end] = text_ranges[i];
+		string_view text = text_files[i].view().substr(begin, end - begin);
+		while (!text.empty()) {
+			auto end = text.find('\n', std::min(target, text.size()) - 1);
+			end = end == string_view::npos ? text.size() : end + 1;
+			res.push_back({ i, false, text.substr(0, end), 0, 0 });
+			text.remove_prefix(end);
+		}
+	}
+
+	/* Binary: split each file's blocks into count ranges */
+	for (size_t i = 0; i < binary_files.size(); ++i) {
+		const auto& [begin, end] = binary_ranges[i];
+		const auto per_chunk = std::max<size_t>((end - begin + count - 1) / std::max<size_t>(count, 1), 1);
+		for (size_t b = begin; b < end; b += per_chunk) {
+			res.push_back({ i, true, {}, b, std::min(end, b + per_chunk) });
+		}
+	}
+
+	return res;
+}
+
+vector<LogChunk> LogReader::chunks(size_t count) const
+{
+	vector<pair<size_t, size_t>> text_ranges;
+	for (const auto& file : text_files) {
+		text_ranges.emplace_back(0, file.size());
+	}
+	vector<pair<size_t, size_t>> binary_ranges;
+	for (const auto& file : binary_files) {
+		binary_ranges.emplace_back(0, file.blocks.size());
+	}
+	return split(count, text_ranges, binary_ranges);
+}
+
+/* FNV-1a hash of the start of a text file */
+static uint64_t fingerprint(string_view text, size_t length)
+{
+	constexpr size_t max_length = 4096;
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (const auto c : text.substr(0, std::min(length, max_length))) {
+		h = (h ^ uint8_t(c)) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+const LogProgress::File *LogProgress::find(const string& name) const
+{
+	for (const auto& file : files) {
+		if (file.name == name) {
+			return &file;
+		}
+	}
+	return nullptr;
+}
+
+/* Name of a file in progress: however the log's path was spelled, so that "log.dat", "./log.dat" and "dir/" vs "dir" match */
+static string progress_name(const string& file)
+{
+	return fs::canonical(file).string();
+}
+
+LogProgress LogReader::end() const
+{
+	LogProgress res;
+	for (size_t i = 0; i < text_files.size(); ++i) {
+		const auto text = text_files[i].view();
+		const auto last = text.rfind('\n');
+		const size_t offset = last == string_view::npos ? 0 : last + 1;
+		res.files.push_back({ progress_name(text_names[i]), false, offset, fingerprint(text, offset) });
+	}
+	for (size_t i = 0; i < binary_files.size(); ++i) {
+		res.files.push_back({ progress_name(binary_names[i]), true, binary_files[i].blocks.size(), 0 });
+	}
+	return res;
+}
+
+vector<LogChunk> LogReader::chunks(size_t count, const LogProgress& from) const
+{
+	const auto to = end();
+	/* Reading on would count that file's events twice if they're now in another file (e.g. merged shards), or lose them */
+	for (const auto& file : from.files) {
+		if (!to.find(file.name)) {
+			throw std::runtime_error("Log file " + file.name + " has been read before but isn't part of the log any more, was it moved or merged into another file?");
+		}
+	}
+	auto start = [&] (const LogProgress::File& file) -> uint64_t {
+		const auto *prev = from.find(file.name);
+		if (!prev) {
+			return 0;
+		}
+		if (prev->binary != file.binary || prev->offset > file.offset) {
+			throw std::runtime_error("Log file " + file.name + " is shorter than when last read, was it replaced?");
+		}
+		return prev->offset;
+	};
+
+	vector<pair<size_t, size_t>> text_ranges;
+	for (size_t i = 0; i < text_files.size(); ++i) {
+		const auto& file = to.files[i];
+		const auto begin = start(file);
+		if (begin > 0 && fingerprint(text_files[i].view(), begin) != from.find(file.name)->fingerprint) {
+			throw std::runtime_error("Log file " + file.name + " has changed since it was last read, it's not just been appended to");
+		}
+		text_ranges.emplace_back(begin, file.offset);
+	}
+	vector<pair<size_t, size_t>> binary_ranges;
+	for (size_t i = 0; i < binary_files.size(); ++i) {
+		const auto& file = to.files[text_files.size() + i];
+		binary_ranges.emplace_back(start(file), file.offset);
+	}
+	return split(count, text_ranges, binary_ranges);
+}
+
+bool LogReader::parse_line(string_view line, EventView& event)
+{
+	/* Game id then key/value pairs, all tab-terminated: odd number of fields */
+	const auto fields = std::count(line.begin(), line.end(), '\t');
+	if ((fields & 1) == 0) {
+		return false;
+	}
+	const auto end = line.find('\t');
+	event._game = line.substr(0, end);
+	event.text = line.substr(end + 1);
+	return true;
+}
+
+}
@@ -0,0 +1,206 @@
+#pragma once
+/*
+ * Reads an event log (text or binary, single file or shard directory) for the
+ * analysis tools.
+ *
+ * Text logs are memory-mapped and events are presented as string_views into
+ * the mapping, so reading needs no per-field allocation.  Binary logs are
+ * decoded into their (already compact) columnar blocks.
+ *
+ * For parallel parsing, the log can be split into chunks (newline-aligned
+ * ranges of text, or ranges of binary blocks).  Chunks are in log order, so
+ * merging per-chunk results in chunk order gives the same result as a
+ * sequential pass.
+ */
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "BinaryLog.hpp"
+
+namespace mugloar
+{
+
+/* Value of a feature, parsed on demand from the text log */
+class FieldValue
+{
+	const char *text;
+	float number;
+
+public:
+	FieldValue(const char *text) : text(text), number(0) { }
+	FieldValue(float number) : text(nullptr), number(number) { }
+
+	/* Text fields are tab-terminated, which stops strtof */
+	float get() const { return text ? std::strtof(text, nullptr) : number; }
+
+	operator float () const { return get(); }
+};
+
+/* One event of the log, valid during the for_each_event callback */
+class EventView
+{
+	friend class LogReader;
+
+	std::string_view _game;
+
+	/* Text log: "key\tvalue\t" pairs following the game id */
+	std::string_view text;
+
+	/* Binary log */
+	const EventBlock *block = nullptr;
+	size_t index = 0;
+	const std::vector<std::string> *names = nullptr;
+
+public:
+	std::string_view game() const { return _game; }
+
+	/* Call func(tag, value) for each feature of the event */
+	template <typename Func>
+	void for_each_feature(Func func) const
+	{
+		if (block) {
+			for (auto j = block->offsets[index]; j < block->offsets[index + 1]; ++j) {
+				func(std::string_view((*names)[block->features[j]]), FieldValue(block->values[j]));
+			}
+			return;
+		}
+		std::string_view sv = text;
+		std::string_view::size_type end;
+		while ((end = sv.find('\t')) != std::string_view::npos) {
+			const auto tag = sv.substr(0, end);
+			sv.remove_prefix(end + 1);
+			if ((end = sv.find('\t')) == std::string_view::npos) {
+				break;
+			}
+			func(tag, FieldValue(sv.data()));
+			sv.remove_prefix(end + 1);
+		}
+	}
+};
+
+/* Contiguous part of the log */
+struct LogChunk
+{
+	/* Index into text or binary files */
+	size_t file;
+	bool binary;
+
+	/* Text files: newline-aligned range of text */
+	std::string_view text;
+
+	/* Binary files: range of blocks */
+	size_t block_begin;
+	size_t block_end;
+};
+
+/*
+ * How far each file of a log has been read, for resuming from there once more
+ * has been appended: text files up to a byte offset just after a newline,
+ * binary files up to a block.  The fingerprint (hash of the start of a text
+ * file) detects a file which was replaced rather than appended to.
+ */
+struct LogProgress
+{
+	struct File
+	{
+		/* Canonical path */
+		std::string name;
+		bool binary;
+		std::uint64_t offset;
+		std::uint64_t fingerprint;
+	};
+
+	std::vector<File> files;
+
+	const File *find(const std::string& name) const;
+};
+
+class LogReader
+{
+	struct BinaryFile
+	{
+		std::vector<std::string> names;
+		std::vector<std::string> games;
+		std::vector<EventBlock> blocks;
+	};
+
+	std::vector<std::string> text_names;
+	std::vector<MappedFile> text_files;
+	std::vector<std::string> binary_names;
+	std::vector<BinaryFile> binary_files;
+
+	/* Split [begin, end) byte ranges of text files and block ranges of binary files into chunks */
+	std::vector<LogChunk> split(size_t count, const std::vector<std::pair<size_t, size_t>>& text_ranges, const std::vector<std::pair<size_t, size_t>>& binary_ranges) const;
+
+public:
+	/* Opens the file, or all shards in the directory */
+	LogReader(const std::string& path);
+
+	/* Mapped text files */
+	const std::vector<MappedFile>& texts() const { return text_files; }
+
+	/* Total size of mapped text */
+	size_t text_size() const;
+
+	/* Parse one line of a text log, returns false (and warns) if it's malformed */
+	static bool parse_line(std::string_view line, EventView& event);
+
+	/* Split log into (roughly) count chunks of similar size, in log order */
+	std::vector<LogChunk> chunks(size_t count) const;
+
+	/* Progress at the end of the log (ignoring any partly-written last line) */
+	LogProgress end() const;
+
+	/*
+	 * Split the part of the log from progress up to end() into chunks (files
+	 * missing from progress are read from their start).  Throws
+	 * std::runtime_error if a file is shorter than progress, or was replaced,
+	 * or if a file in progress is no longer part of the log.
+	 */
+	std::vector<LogChunk> chunks(size_t count, const LogProgress& from) const;
+
+	/* Call func(event) for each event of a chunk, skipping (and reporting) malformed lines */
+	template <typename Func>
+	void for_each_event(const LogChunk& chunk, Func func) const
+	{
+		EventView event;
+		if (!chunk.binary) {
+			const auto& file = text_files[chunk.file];
+			for_each_line(chunk.text, [&] (std::string_view line) {
+				if (parse_line(line, event)) {
+					func(event);
+				} else {
+					std::cerr << "Invalid line at byte " << (line.data() - file.view().data()) << " of " << text_names[chunk.file] << " ignored" << std::endl;
+				}
+			});
+			return;
+		}
+		const auto& file = binary_files[chunk.file];
+		event.names = &file.names;
+		for (auto b = chunk.block_begin; b < chunk.block_end; ++b) {
+			const auto& block = file.blocks[b];
+			event.block = &block;
+			for (event.index = 0; event.index < block.size(); ++event.index) {
+				event._game = file.games[block.game[event.index]];
+				func(event);
+			}
+		}
+	}
+
+	/* Call func(event) for each event of the whole log */
+	template <typename Func>
+	void for_each_event(Func func) const
+	{
+		for (const auto& chunk : chunks(1)) {
+			for_each_event(chunk, func);
+		}
+	}
+};
+
+}
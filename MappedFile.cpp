@@ -0,0 +1,76 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "MappedFile.hpp"
+
+using std::string;
+
+namespace mugloar
+{
+
+MappedFile::MappedFile(const string& filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open " + filename + ": " + strerror(errno));
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		throw std::runtime_error("Failed to stat " + filename + ": " + strerror(errno));
+	}
+	_size = st.st_size;
+	/* mmap fails for empty files, leave those as an empty view */
+	if (_size > 0) {
+		void *p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map " + filename + ": " + strerror(errno));
+		}
+		/* We read logs front to back */
+		madvise(p, _size, MADV_SEQUENTIAL);
+		_data = static_cast<const char *>(p);
+	}
+	close(fd);
+}
+
+MappedFile::MappedFile(MappedFile&& other) :
+	_data(std::exchange(other._data, nullptr)),
+	_size(std::exchange(other._size, 0))
+{
+}
+
+MappedFile& MappedFile::operator = (MappedFile&& other)
+{
+	std::swap(_data, other._data);
+	std::swap(_size, other._size);
+	return *this;
+}
+
+void MappedFile::release(std::string_view part) const
+{
+	/* Only whole pages within the part */
+	const auto page = uintptr_t(sysconf(_SC_PAGESIZE));
+	const auto begin = (uintptr_t(part.data()) + page - 1) & ~(page - 1);
+	const auto end = (uintptr_t(part.data() + part.size())) & ~(page - 1);
+	if (end > begin) {
+		madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (_data) {
+		munmap(const_cast<char *>(_data), _size);
+	}
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+/*
+ * Read-only memory-mapped file, with helpers to split its contents into lines
+ * and tab-terminated fields as string_views straight into the mapping.
+ *
+ * Parsing a multi-GB log this way needs no per-field allocations, and the
+ * mapped pages can be dropped by the OS under memory pressure.
+ */
+#include <string>
+#include <string_view>
+
+namespace mugloar
+{
+
+class MappedFile
+{
+	const char *_data = nullptr;
+	size_t _size = 0;
+
+public:
+	MappedFile() = default;
+
+	/* Throws std::runtime_error if the file can't be mapped */
+	MappedFile(const std::string& filename);
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other);
+	MappedFile& operator = (MappedFile&& other);
+
+	~MappedFile();
+
+	std::string_view view() const { return { _data, _size }; }
+	size_t size() const { return _size; }
+
+	/* Drop the pages of part of view() which we're done with from memory (they're read back in if accessed again) */
+	void release(std::string_view part) const;
+};
+
+/* Call func(line) for each line of text (without the newline) */
+template <typename Func>
+void for_each_line(std::string_view text, Func func)
+{
+	while (!text.empty()) {
+		auto end = text.find('\n');
+		if (end == std::string_view::npos) {
+			func(text);
+			break;
+		}
+		func(text.substr(0, end));
+		text.remove_prefix(end + 1);
+	}
+}
+
+/* Call func(field) for each tab-terminated field in line (unterminated trailing text is ignored) */
+template <typename Func>
+void for_each_field(std::string_view line, Func func)
+{
+	std::string_view::size_type end;
+	while ((end = line.find('\t')) != std::string_view::npos) {
+		func(line.substr(0, end));
+		line.remove_prefix(end + 1);
+	}
+}
+
+}
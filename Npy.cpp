@@ -0,0 +1,56 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "Npy.hpp"
+
+using std::string;
+using std::vector;
+using std::ofstream;
+using std::int32_t;
+using std::int64_t;
+using std::uint16_t;
+
+namespace mugloar
+{
+
+/* Little-endian host is assumed, as for the binary event log */
+template <typename T>
+static void write_array(const string& filename, const char *descr, const vector<T>& data)
+{
+	string header = string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': (" + std::to_string(data.size()) + ",), }";
+
+	/* Magic (6) + version (2) + header length (2) + header + newline, padded to 64 bytes */
+	const size_t prefix = 10;
+	header.append(63 - (prefix + header.size()) % 64, ' ');
+	header.push_back('\n');
+
+	ofstream f(filename, std::ios::binary | std::ios_base::trunc);
+	const char magic[] = { '\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0 };
+	f.write(magic, sizeof(magic));
+	const uint16_t length = header.size();
+	const char length_bytes[] = { char(length & 0xff), char(length >> 8) };
+	f.write(length_bytes, sizeof(length_bytes));
+	f.write(header.data(), header.size());
+	f.write(reinterpret_cast<const char *>(data.data()), data.size() * sizeof(T));
+	f.close();
+	if (!f) {
+		throw std::runtime_error("Failed to write " + filename);
+	}
+}
+
+void write_npy(const string& filename, const vector<float>& data)
+{
+	write_array(filename, "<f4", data);
+}
+
+void write_npy(const string& filename, const vector<int32_t>& data)
+{
+	write_array(filename, "<i4", data);
+}
+
+void write_npy(const string& filename, const vector<int64_t>& data)
+{
+	write_array(filename, "<i8", data);
+}
+
+}
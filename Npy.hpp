@@ -0,0 +1,20 @@
+#pragma once
+/*
+ * Writes one-dimensional arrays in NumPy's .npy format (version 1.0), which
+ * can be memory-mapped by external tools with numpy.load(..., mmap_mode='r').
+ *
+ * The header is padded so that the data starts 64-byte aligned.
+ */
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mugloar
+{
+
+/* Throw std::runtime_error on failure */
+void write_npy(const std::string& filename, const std::vector<float>& data);
+void write_npy(const std::string& filename, const std::vector<std::int32_t>& data);
+void write_npy(const std::string& filename, const std::vector<std::int64_t>& data);
+
+}
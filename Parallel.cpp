@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <iostream>
 #include <thread>
+#include <vector>
 #include <exception>
 #include <unistd.h>
 #include <csignal>
@@ -93,3 +95,34 @@ void run_parallel(int worker_count, function<void()> task)
 
 	cerr << "Stopped." << endl;
 }
+
+unsigned default_thread_count()
+{
+	return std::max(1u, thread::hardware_concurrency());
+}
+
+void parallel_for(size_t count, unsigned thread_count, function<void(size_t)> task)
+{
+	atomic<size_t> next { 0 };
+	auto worker = [&] () {
+		for (size_t i; (i = next++) < count; ) {
+			task(i);
+		}
+	};
+
+	thread_count = std::max(1u, std::min<unsigned>(thread_count, count));
+	if (thread_count == 1) {
+		worker();
+		return;
+	}
+
+	vector<thread> workers;
+	workers.reserve(thread_count - 1);
+	for (unsigned i = 1; i < thread_count; i++) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (auto& w : workers) {
+		w.join();
+	}
+}
@@ -17,3 +17,13 @@ extern thread_local int worker_id;
 
 /* Run multiple instances of task in separate threads, wait for use to request exit */
 void run_parallel(int worker_count, std::function<void()> task);
+
+/* Default thread count for batch processing (number of CPUs) */
+unsigned default_thread_count();
+
+/*
+ * Run task(i) for i in [0, count) on up to thread_count threads, returning
+ * once all are done.  Tasks are handed out in order, one at a time, so tasks
+ * of uneven size still balance out.
+ */
+void parallel_for(size_t count, unsigned thread_count, std::function<void(size_t)> task);
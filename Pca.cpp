@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+
+#include "Pca.hpp"
+#include "Parallel.hpp"
+
+using std::vector;
+using std::pair;
+using std::int32_t;
+using std::uint32_t;
+using std::cerr;
+using std::endl;
+
+namespace mugloar
+{
+
+/* Columns per tile of the correlation matrix (a tile of doubles is 128KB, so fits in L2) */
+static constexpr size_t tile_size = 128;
+
+/* Rows compacted at a time, bounding the memory of the compacted copy */
+static constexpr size_t batch_rows = 1 << 16;
+
+void Projection::project(const SparseRows& m, size_t row, double *out) const
+{
+	const auto k = components();
+	std::copy(origin.begin(), origin.end(), out);
+	for (auto i = m.indptr[row]; i < m.indptr[row + 1]; ++i) {
+		const auto pos = position[m.indices[i]];
+		if (pos < 0) {
+			continue;
+		}
+		const double x = m.values[i] / scale[pos];
+		const double *axis = &loadings[pos * k];
+		for (size_t c = 0; c < k; ++c) {
+			out[c] += x * axis[c];
+		}
+	}
+}
+
+vector<double> correlation(const SparseRows& m, const vector<int32_t>& columns, unsigned thread_count, vector<double>& mean, vector<double>& scale)
+{
+	const size_t d = columns.size();
+	const size_t blocks = (d + tile_size - 1) / tile_size;
+
+	vector<int32_t> position(m.cols, -1);
+	for (size_t i = 0; i < d; ++i) {
+		position[columns[i]] = i;
+	}
+
+	/* Tiles of the upper triangle (by block), each accumulated by one thread at a time */
+	vector<pair<uint32_t, uint32_t>> tiles;
+	for (size_t bi = 0; bi < blocks; ++bi) {
+		for (size_t bj = bi; bj < blocks; ++bj) {
+			tiles.emplace_back(bi, bj);
+		}
+	}
+
+	/* Weighted sums of x_i * x_j, and of x_i */
+	vector<double> cov(d * d, 0.0);
+	vector<double> sum(d, 0.0);
+	double total_weight = 0;
+
+	/* Compacted batch: selected non-zeros of each row, with the start of each block of columns within the row */
+	vector<int32_t> idx;
+	vector<float> val;
+	vector<uint32_t> offset;
+	vector<vector<uint32_t>> block_rows(blocks);
+
+	for (size_t begin = 0; begin < m.rows; begin += batch_rows) {
+		const size_t end = std::min(m.rows, begin + batch_rows);
+		const size_t n = end - begin;
+
+		idx.clear();
+		val.clear();
+		offset.resize(n * (blocks + 1));
+		for (auto& rows : block_rows) {
+			rows.clear();
+		}
+		for (size_t r = 0; r < n; ++r) {
+			const auto row = begin + r;
+			const double w = m.weights[row];
+			total_weight += w;
+			const auto row_start = idx.size();
+			/* Columns are sorted within the row, so positions are too */
+			for (auto i = m.indptr[row]; i < m.indptr[row + 1]; ++i) {
+				const auto pos = position[m.indices[i]];
+				if (pos >= 0) {
+					idx.push_back(pos);
+					val.push_back(m.values[i]);
+					sum[pos] += w * m.values[i];
+				}
+			}
+			auto *off = &offset[r * (blocks + 1)];
+			size_t j = row_start;
+			for (size_t b = 0; b < blocks; ++b) {
+				off[b] = j;
+				while (j < idx.size() && size_t(idx[j]) < (b + 1) * tile_size) {
+					++j;
+				}
+				if (j > off[b]) {
+					block_rows[b].push_back(r);
+				}
+			}
+			off[blocks] = j;
+		}
+
+		parallel_for(tiles.size(), thread_count, [&] (size_t t) {
+			const auto [bi, bj] = tiles[t];
+			for (const auto r : block_rows[bi]) {
+				const auto *off = &offset[r * (blocks + 1)];
+				const auto jb = off[bj];
+				const auto je = off[bj + 1];
+				if (jb == je) {
+					continue;
+				}
+				const double w = m.weights[begin + r];
+				for (auto a = off[bi]; a < off[bi + 1]; ++a) {
+					const double wa = w * val[a];
+					double *cov_row = &cov[idx[a] * d];
+					for (auto b = jb; b < je; ++b) {
+						cov_row[idx[b]] += wa * val[b];
+					}
+				}
+			}
+		});
+	}
+
+	/* Mirror the lower triangle of blocks */
+	for (size_t i = 0; i < d; ++i) {
+		for (size_t j = 0; j < i; ++j) {
+			if (j / tile_size != i / tile_size) {
+				cov[i * d + j] = cov[j * d + i];
+			}
+		}
+	}
+
+	/* Covariance, then correlation */
+	mean.assign(d, 0.0);
+	scale.assign(d, 1.0);
+	if (total_weight <= 0) {
+		return cov;
+	}
+	for (size_t i = 0; i < d; ++i) {
+		mean[i] = sum[i] / total_weight;
+	}
+	for (size_t i = 0; i < d; ++i) {
+		double *cov_row = &cov[i * d];
+		for (size_t j = 0; j < d; ++j) {
+			cov_row[j] = cov_row[j] / total_weight - mean[i] * mean[j];
+		}
+	}
+	vector<char> constant(d);
+	for (size_t i = 0; i < d; ++i) {
+		const double var = cov[i * d + i];
+		constant[i] = !(var > 1e-12 * std::max(1.0, mean[i] * mean[i]));
+		scale[i] = constant[i] ? 1.0 : std::sqrt(var);
+	}
+	for (size_t i = 0; i < d; ++i) {
+		double *cov_row = &cov[i * d];
+		for (size_t j = 0; j < d; ++j) {
+			cov_row[j] = constant[i] || constant[j] ? 0.0 : cov_row[j] / (scale[i] * scale[j]);
+		}
+	}
+	return cov;
+}
+
+/* out = a * q, for d x d matrix a and d x k matrix q (row-major) */
+static void multiply(const vector<double>& a, const vector<double>& q, vector<double>& out, size_t d, size_t k, unsigned thread_count)
+{
+	constexpr size_t rows_per_task = 64;
+	out.assign(d * k, 0.0);
+	parallel_for((d + rows_per_task - 1) / rows_per_task, thread_count, [&] (size_t t) {
+		const auto end = std::min(d, (t + 1) * rows_per_task);
+		for (size_t i = t * rows_per_task; i < end; ++i) {
+			double *out_row = &out[i * k];
+			for (size_t j = 0; j < d; ++j) {
+				const double aij = a[i * d + j];
+				const double *q_row = &q[j * k];
+				for (size_t c = 0; c < k; ++c) {
+					out_row[c] += aij * q_row[c];
+				}
+			}
+		}
+	});
+}
+
+/* Modified Gram-Schmidt on the columns of d x k matrix q */
+static void orthonormalise(vector<double>& q, size_t d, size_t k)
+{
+	for (size_t c = 0; c < k; ++c) {
+		for (size_t p = 0; p < c; ++p) {
+			double dot = 0;
+			for (size_t i = 0; i < d; ++i) {
+				dot += q[i * k + c] * q[i * k + p];
+			}
+			for (size_t i = 0; i < d; ++i) {
+				q[i * k + c] -= dot * q[i * k + p];
+			}
+		}
+		double norm = 0;
+		for (size_t i = 0; i < d; ++i) {
+			norm += q[i * k + c] * q[i * k + c];
+		}
+		norm = std::sqrt(norm);
+		for (size_t i = 0; i < d; ++i) {
+			q[i * k + c] = norm > 1e-150 ? q[i * k + c] / norm : 0.0;
+		}
+	}
+}
+
+/* Cyclic Jacobi eigen-decomposition of symmetric k x k matrix h: eigenvalues on its diagonal, eigenvectors in the columns of v */
+static void jacobi(vector<double>& h, vector<double>& v, size_t k)
+{
+	v.assign(k * k, 0.0);
+	for (size_t i = 0; i < k; ++i) {
+		v[i * k + i] = 1;
+	}
+	for (int sweep = 0; sweep < 100; ++sweep) {
+		double off = 0;
+		for (size_t p = 0; p < k; ++p) {
+			for (size_t q = p + 1; q < k; ++q) {
+				off += h[p * k + q] * h[p * k + q];
+			}
+		}
+		if (off < 1e-30) {
+			break;
+		}
+		for (size_t p = 0; p < k; ++p) {
+			for (size_t q = p + 1; q < k; ++q) {
+				const double hpq = h[p * k + q];
+				if (std::abs(hpq) < 1e-300) {
+					continue;
+				}
+				const double theta = (h[q * k + q] - h[p * k + p]) / (2 * hpq);
+				const double t = (theta >= 0 ? 1 : -1) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+				const double c = 1 / std::sqrt(t * t + 1);
+				const double s = t * c;
+				for (size_t i = 0; i < k; ++i) {
+					const double hip = h[i * k + p];
+					const double hiq = h[i * k + q];
+					h[i * k + p] = c * hip - s * hiq;
+					h[i * k + q] = s * hip + c * hiq;
+				}
+				for (size_t i = 0; i < k; ++i) {
+					const double hpi = h[p * k + i];
+					const double hqi = h[q * k + i];
+					h[p * k + i] = c * hpi - s * hqi;
+					h[q * k + i] = s * hpi + c * hqi;
+				}
+				for (size_t i = 0; i < k; ++i) {
+					const double vip = v[i * k + p];
+					const double viq = v[i * k + q];
+					v[i * k + p] = c * vip - s * viq;
+					v[i * k + q] = s * vip + c * viq;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Rotate orthonormal d x p basis q onto the eigenvectors of a projected onto
+ * it (Rayleigh-Ritz), in descending order of eigenvalue, which are returned
+ */
+static vector<double> rayleigh_ritz(const vector<double>& a, vector<double>& q, size_t d, size_t p, unsigned thread_count)
+{
+	vector<double> z;
+	multiply(a, q, z, d, p, thread_count);
+	vector<double> h(p * p, 0.0);
+	for (size_t i = 0; i < d; ++i) {
+		for (size_t x = 0; x < p; ++x) {
+			for (size_t y = 0; y < p; ++y) {
+				h[x * p + y] += q[i * p + x] * z[i * p + y];
+			}
+		}
+	}
+	/* Symmetrise rounding errors */
+	for (size_t x = 0; x < p; ++x) {
+		for (size_t y = 0; y < x; ++y) {
+			h[x * p + y] = h[y * p + x] = (h[x * p + y] + h[y * p + x]) / 2;
+		}
+	}
+	vector<double> v;
+	jacobi(h, v, p);
+
+	vector<size_t> order(p);
+	for (size_t c = 0; c < p; ++c) {
+		order[c] = c;
+	}
+	std::sort(order.begin(), order.end(), [&] (size_t x, size_t y) { return h[x * p + x] > h[y * p + y]; });
+
+	vector<double> values(p);
+	vector<double> rotated(d * p, 0.0);
+	for (size_t c = 0; c < p; ++c) {
+		const auto src = order[c];
+		values[c] = h[src * p + src];
+		for (size_t i = 0; i < d; ++i) {
+			double x = 0;
+			for (size_t y = 0; y < p; ++y) {
+				x += q[i * p + y] * v[y * p + src];
+			}
+			rotated[i * p + c] = x;
+		}
+	}
+	q.swap(rotated);
+	return values;
+}
+
+Projection principal_components(const SparseRows& m, const vector<int32_t>& columns, size_t k, unsigned thread_count)
+{
+	Projection res;
+	res.columns = columns;
+	const auto corr = correlation(m, columns, thread_count, res.mean, res.scale);
+	const size_t d = columns.size();
+	k = std::min(k, d);
+
+	/*
+	 * Subspace iteration from a random (but reproducible) start.  Extra
+	 * vectors are iterated, as convergence of the top k is governed by the
+	 * ratio of eigenvalue p + 1 to eigenvalue k, and those of features with
+	 * little correlation are close together.
+	 */
+	const size_t p = std::min(d, std::max(2 * k, k + 8));
+	vector<double> q(d * p);
+	std::mt19937 prng(1);
+	std::normal_distribution<double> normal;
+	for (auto& x : q) {
+		x = normal(prng);
+	}
+	orthonormalise(q, d, p);
+
+	vector<double> z;
+	vector<double> values(p, 0.0);
+	constexpr int max_iterations = 1000;
+	constexpr int check_interval = 10;
+	int iteration = 0;
+	for (bool converged = false; !converged && iteration < max_iterations; ) {
+		for (int i = 0; i < check_interval; ++i, ++iteration) {
+			multiply(corr, q, z, d, p, thread_count);
+			q.swap(z);
+			orthonormalise(q, d, p);
+		}
+		const auto prev = values;
+		values = rayleigh_ritz(corr, q, d, p, thread_count);
+		converged = true;
+		for (size_t c = 0; c < k; ++c) {
+			converged = converged && std::abs(values[c] - prev[c]) <= 1e-9 * std::max(1.0, std::abs(values[c]));
+		}
+	}
+	cerr << "Subspace iteration " << (iteration < max_iterations ? "converged" : "stopped") << " after " << iteration << " iterations" << endl;
+
+	res.eigenvalues.resize(k);
+	res.loadings.assign(d * k, 0.0);
+	for (size_t c = 0; c < k; ++c) {
+		res.eigenvalues[c] = values[c];
+		for (size_t i = 0; i < d; ++i) {
+			res.loadings[i * k + c] = q[i * p + c];
+		}
+		/* Eigenvectors have no inherent sign: make the largest loading positive, for reproducible output */
+		size_t largest = 0;
+		for (size_t i = 0; i < d; ++i) {
+			if (std::abs(res.loadings[i * k + c]) > std::abs(res.loadings[largest * k + c])) {
+				largest = i;
+			}
+		}
+		if (d > 0 && res.loadings[largest * k + c] < 0) {
+			for (size_t i = 0; i < d; ++i) {
+				res.loadings[i * k + c] = -res.loadings[i * k + c];
+			}
+		}
+	}
+
+	res.position.assign(m.cols, -1);
+	res.origin.assign(k, 0.0);
+	for (size_t i = 0; i < d; ++i) {
+		res.position[columns[i]] = i;
+		for (size_t c = 0; c < k; ++c) {
+			res.origin[c] -= res.mean[i] / res.scale[i] * res.loadings[i * k + c];
+		}
+	}
+
+	return res;
+}
+
+}
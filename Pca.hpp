@@ -0,0 +1,65 @@
+#pragma once
+/*
+ * Principal component analysis of a weighted sparse (CSR) feature matrix.
+ *
+ * Features are standardised (PCA of the correlation matrix), as their scales
+ * range from 0/1 flags to gold and score counts.  The correlation matrix of the
+ * selected columns is accumulated densely, in cache-sized tiles which are
+ * shared out between threads, and the top-k eigenvectors are found by subspace
+ * iteration.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mugloar
+{
+
+/* Read-only view of a CSR matrix with a weight per row */
+struct SparseRows
+{
+	const std::int64_t *indptr;
+	const std::int32_t *indices;
+	const float *values;
+	const float *weights;
+	size_t rows;
+	size_t cols;
+};
+
+struct Projection
+{
+	/* Columns of the matrix which were analysed, ascending */
+	std::vector<std::int32_t> columns;
+
+	/* Weighted mean and standard deviation of each column (1 if constant) */
+	std::vector<double> mean;
+	std::vector<double> scale;
+
+	/* Largest eigenvalues of the correlation matrix, descending */
+	std::vector<double> eigenvalues;
+
+	/* Principal axes, loadings[i * components() + c] for column i of component c */
+	std::vector<double> loadings;
+
+	/* Component scores of a row which is all zeros */
+	std::vector<double> origin;
+
+	/* Index into columns of each column of the matrix, -1 if not analysed */
+	std::vector<std::int32_t> position;
+
+	size_t components() const { return eigenvalues.size(); }
+
+	/* Component scores of a row of the matrix (out must have components() elements) */
+	void project(const SparseRows& m, size_t row, double *out) const;
+};
+
+/*
+ * Weighted correlation matrix (dense, row-major) of the given columns of m,
+ * also giving the columns' weighted means and standard deviations
+ */
+std::vector<double> correlation(const SparseRows& m, const std::vector<std::int32_t>& columns, unsigned thread_count, std::vector<double>& mean, std::vector<double>& scale);
+
+/* Top k principal components of the given columns of m */
+Projection principal_components(const SparseRows& m, const std::vector<std::int32_t>& columns, size_t k, unsigned thread_count);
+
+}
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+
+#include "ScoreLog.hpp"
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+
+using std::string;
+using std::string_view;
+using std::stringstream;
+using std::uint64_t;
+using std::chrono::system_clock;
+
+/* Scores can get large */
+using Int = long long;
+
+namespace mugloar
+{
+
+ScoreRecord::ScoreRecord(const Game& game, double wall_time) :
+	id(game.id()),
+	score(game.score()),
+	turns(game.turn()),
+	level(game.level()),
+	lives(game.lives()),
+	api_calls(game.api_calls()),
+	wall_time(wall_time),
+	worker(worker_id),
+	time(std::chrono::duration_cast<std::chrono::microseconds>(system_clock::now().time_since_epoch()).count())
+{
+}
+
+string format_score(const ScoreRecord& record)
+{
+	stringstream ss;
+	ss << "id=" << record.id
+		<< "\tscore=" << Int(record.score)
+		<< "\tturns=" << Int(record.turns)
+		<< "\tlevel=" << Int(record.level)
+		<< "\tlives=" << Int(record.lives)
+		<< "\tcalls=" << record.api_calls
+		<< "\twall=" << record.wall_time
+		<< "\tworker=" << record.worker
+		<< "\ttime=" << record.time
+		<< "\t" << "\n";
+	return ss.str();
+}
+
+bool parse_score(string_view line, ScoreRecord& record)
+{
+	record = ScoreRecord();
+	bool has_id = false;
+	bool has_score = false;
+	for_each_field(line, [&] (string_view field) {
+		const auto eq = field.find('=');
+		if (eq == string_view::npos) {
+			return;
+		}
+		const auto key = field.substr(0, eq);
+		/* Fields are tab-terminated, which stops strto* */
+		const char *value = field.data() + eq + 1;
+		if (key == "id") {
+			record.id = string(field.substr(eq + 1));
+			has_id = true;
+		} else if (key == "score") {
+			record.score = std::strtod(value, nullptr);
+			has_score = true;
+		} else if (key == "turns") {
+			record.turns = std::strtod(value, nullptr);
+		} else if (key == "level") {
+			record.level = std::strtod(value, nullptr);
+		} else if (key == "lives") {
+			record.lives = std::strtod(value, nullptr);
+		} else if (key == "calls") {
+			record.api_calls = std::strtoul(value, nullptr, 10);
+		} else if (key == "wall") {
+			record.wall_time = std::strtod(value, nullptr);
+		} else if (key == "worker") {
+			record.worker = std::strtol(value, nullptr, 10);
+		} else if (key == "time") {
+			record.time = std::strtoull(value, nullptr, 10);
+		}
+	});
+	return has_id && has_score;
+}
+
+}
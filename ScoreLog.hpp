@@ -0,0 +1,47 @@
+#pragma once
+/*
+ * End-game score records, appended to the scores file by the players, one
+ * line of tab-terminated "key=value" fields per game:
+ *
+ *   id=<game> score=<n> turns=<n> level=<n> lives=<n> calls=<n> wall=<seconds> worker=<n> time=<microseconds>
+ *
+ * The first five fields are those of older scores files, which can still be
+ * read (with the other fields left at zero).
+ */
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "Game.hpp"
+
+namespace mugloar
+{
+
+struct ScoreRecord
+{
+	GameId id;
+	Number score = 0;
+	Number turns = 0;
+	Number level = 0;
+	Number lives = 0;
+	/* API requests made */
+	unsigned api_calls = 0;
+	/* Wall time spent playing, in seconds */
+	double wall_time = 0;
+	int worker = 0;
+	/* End of game, microseconds since epoch (0 if unknown) */
+	std::uint64_t time = 0;
+
+	ScoreRecord() = default;
+
+	/* Result of a finished game, played by this thread */
+	ScoreRecord(const Game& game, double wall_time);
+};
+
+/* Format record as a line of the scores file (with newline) */
+std::string format_score(const ScoreRecord& record);
+
+/* Parse a line of the scores file, returns false if it isn't a score record */
+bool parse_score(std::string_view line, ScoreRecord& record);
+
+}
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "TDigest.hpp"
+
+using std::vector;
+using std::uint64_t;
+
+namespace mugloar
+{
+
+/* Scale function k1: centroids span at most one unit of k, so are smallest at the tails */
+static double scale(double q, double compression)
+{
+	return compression / (2 * M_PI) * std::asin(2 * std::clamp(q, 0.0, 1.0) - 1);
+}
+
+TDigest::TDigest(double compression) :
+	compression(compression)
+{
+	clear();
+}
+
+void TDigest::clear()
+{
+	centroids.clear();
+	buffer.clear();
+	total = 0;
+	sum = 0;
+	_min = std::numeric_limits<double>::infinity();
+	_max = -std::numeric_limits<double>::infinity();
+}
+
+void TDigest::add(double x, double weight)
+{
+	if (!std::isfinite(x) || weight <= 0) {
+		return;
+	}
+	buffer.push_back({ x, weight });
+	total += weight;
+	sum += x * weight;
+	_min = std::min(_min, x);
+	_max = std::max(_max, x);
+	if (buffer.size() >= size_t(compression) * 4) {
+		flush();
+	}
+}
+
+void TDigest::merge(const TDigest& other)
+{
+	other.flush();
+	buffer.insert(buffer.end(), other.centroids.begin(), other.centroids.end());
+	total += other.total;
+	sum += other.sum;
+	_min = std::min(_min, other._min);
+	_max = std::max(_max, other._max);
+	flush();
+}
+
+void TDigest::flush() const
+{
+	if (buffer.empty()) {
+		return;
+	}
+	buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+	std::sort(buffer.begin(), buffer.end(), [] (const Centroid& a, const Centroid& b) { return a.mean < b.mean; });
+
+	centroids.clear();
+	double so_far = 0;
+	auto cur = buffer.front();
+	double k_lower = scale(0, compression);
+	for (size_t i = 1; i < buffer.size(); ++i) {
+		const auto& next = buffer[i];
+		const double q = (so_far + cur.weight + next.weight) / total;
+		if (scale(q, compression) - k_lower <= 1) {
+			/* Absorb into current centroid */
+			cur.mean += (next.mean - cur.mean) * next.weight / (cur.weight + next.weight);
+			cur.weight += next.weight;
+		} else {
+			so_far += cur.weight;
+			k_lower = scale(so_far / total, compression);
+			centroids.push_back(cur);
+			cur = next;
+		}
+	}
+	centroids.push_back(cur);
+	buffer.clear();
+}
+
+double TDigest::quantile(double q) const
+{
+	flush();
+	if (centroids.empty()) {
+		return 0;
+	}
+	if (centroids.size() == 1) {
+		return centroids.front().mean;
+	}
+	q = std::clamp(q, 0.0, 1.0);
+	const double target = q * total;
+
+	/* Interpolate between centroid midpoints, and out to min/max at the ends */
+	double so_far = 0;
+	double prev_mid = 0;
+	double prev_mean = _min;
+	for (const auto& c : centroids) {
+		const double mid = so_far + c.weight / 2;
+		if (target < mid) {
+			const double t = mid > prev_mid ? (target - prev_mid) / (mid - prev_mid) : 0;
+			return prev_mean + t * (c.mean - prev_mean);
+		}
+		prev_mid = mid;
+		prev_mean = c.mean;
+		so_far += c.weight;
+	}
+	const double t = total > prev_mid ? (target - prev_mid) / (total - prev_mid) : 1;
+	return prev_mean + t * (_max - prev_mean);
+}
+
+WindowedDigest::WindowedDigest(uint64_t length, size_t pane_count, double compression) :
+	pane_length(std::max<uint64_t>(1, length / std::max<size_t>(1, pane_count))),
+	panes(std::max<size_t>(1, pane_count), TDigest(compression))
+{
+}
+
+void WindowedDigest::advance(uint64_t now)
+{
+	const uint64_t pane = now / pane_length;
+	if (pane <= current) {
+		return;
+	}
+	/* Clear the slots of panes which are being reused */
+	const auto stale = std::min<uint64_t>(pane - current, panes.size());
+	for (uint64_t i = 1; i <= stale; ++i) {
+		panes[(current + i) % panes.size()].clear();
+	}
+	current = pane;
+}
+
+void WindowedDigest::add(uint64_t time, double x)
+{
+	advance(time);
+	const uint64_t pane = time / pane_length;
+	if (pane + panes.size() <= current) {
+		return;
+	}
+	panes[pane % panes.size()].add(x);
+}
+
+TDigest WindowedDigest::digest() const
+{
+	TDigest res;
+	for (const auto& pane : panes) {
+		if (pane.count() > 0) {
+			res.merge(pane);
+		}
+	}
+	return res;
+}
+
+}
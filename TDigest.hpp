@@ -0,0 +1,77 @@
+#pragma once
+/*
+ * Streaming quantile estimation in constant memory (Dunning's merging
+ * t-digest).  Values are buffered, and the buffer is merged into a sorted list
+ * of at most ~compression centroids, which are kept small near the tails so
+ * that extreme percentiles stay accurate.
+ *
+ * WindowedDigest keeps percentiles over a sliding time window, as a ring of
+ * digests of equal time slices ("panes"), merged when queried.
+ */
+#include <cstdint>
+#include <vector>
+
+namespace mugloar
+{
+
+class TDigest
+{
+	struct Centroid
+	{
+		double mean;
+		double weight;
+	};
+
+	double compression;
+
+	/* Sorted by mean */
+	mutable std::vector<Centroid> centroids;
+	mutable std::vector<Centroid> buffer;
+
+	double total = 0;
+	double sum = 0;
+	double _min;
+	double _max;
+
+	void flush() const;
+
+public:
+	TDigest(double compression = 100);
+
+	void add(double x, double weight = 1);
+
+	void merge(const TDigest& other);
+
+	void clear();
+
+	double count() const { return total; }
+	double mean() const { return total > 0 ? sum / total : 0; }
+	double min() const { return _min; }
+	double max() const { return _max; }
+
+	/* Estimated value at quantile q (0..1), 0 if empty */
+	double quantile(double q) const;
+};
+
+class WindowedDigest
+{
+	std::uint64_t pane_length;
+	std::vector<TDigest> panes;
+	/* Pane (time / pane_length) that the newest slot holds */
+	std::uint64_t current = 0;
+
+public:
+	/* Window of length (in any time unit) split into pane_count panes */
+	WindowedDigest(std::uint64_t length, size_t pane_count = 10, double compression = 100);
+
+	/* Drop panes which are out of the window at time now */
+	void advance(std::uint64_t now);
+
+	/* Add value at time (older than the window = ignored) */
+	void add(std::uint64_t time, double x);
+
+	/* Merged digest of the window */
+	TDigest digest() const;
+};
+
+}
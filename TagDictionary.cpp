@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <functional>
+
+#include "TagDictionary.hpp"
+
+using std::string_view;
+using std::vector;
+using std::pair;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace mugloar
+{
+
+TagDictionary::TagDictionary(size_t shard_count) :
+	shards(std::max<size_t>(1, shard_count))
+{
+}
+
+void TagDictionary::insert(string_view tag, uint64_t position)
+{
+	auto& shard = shard_of(std::hash<string_view>()(tag));
+	std::scoped_lock lock(shard.mutex);
+	auto [it, is_new] = shard.map.try_emplace(tag, Entry { position, none });
+	if (!is_new && position < it->second.position) {
+		it->second.position = position;
+	}
+}
+
+vector<string_view> TagDictionary::assign_ids()
+{
+	vector<pair<uint64_t, decltype(Shard::map)::value_type *>> entries;
+	entries.reserve(size());
+	for (auto& shard : shards) {
+		for (auto& entry : shard.map) {
+			entries.emplace_back(entry.second.position, &entry);
+		}
+	}
+	std::sort(entries.begin(), entries.end(), [] (const auto& a, const auto& b) { return a.first < b.first; });
+
+	vector<string_view> tags_r;
+	tags_r.reserve(entries.size());
+	for (auto& [position, entry] : entries) {
+		entry->second.id = tags_r.size();
+		tags_r.push_back(entry->first);
+	}
+	return tags_r;
+}
+
+uint32_t TagDictionary::find(string_view tag) const
+{
+	const auto& shard = shard_of(std::hash<string_view>()(tag));
+	const auto it = shard.map.find(tag);
+	return it == shard.map.end() ? none : it->second.id;
+}
+
+size_t TagDictionary::size() const
+{
+	size_t size = 0;
+	for (const auto& shard : shards) {
+		size += shard.map.size();
+	}
+	return size;
+}
+
+}
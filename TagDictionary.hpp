@@ -0,0 +1,65 @@
+#pragma once
+/*
+ * Dictionary of tags (feature names) which many threads can fill at once,
+ * numbering the tags in a deterministic order once filling is done.
+ *
+ * Tags are split between shards by hash, each with its own lock, so threads
+ * rarely wait for each other.  Keys are string_views into the caller's
+ * buffers (e.g. the mapped event log), which must outlive the dictionary.
+ *
+ * Each insert gives the position at which the tag was seen (e.g. chunk number
+ * and position within the chunk); tags are numbered in order of the earliest
+ * position they were seen at, so ids are the same as from a sequential pass,
+ * whatever the number of threads.
+ */
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace mugloar
+{
+
+class TagDictionary
+{
+	struct Entry
+	{
+		std::uint64_t position;
+		std::uint32_t id;
+	};
+
+	/* Own cache line each, so that threads filling different shards don't contend */
+	struct alignas(64) Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string_view, Entry> map;
+	};
+
+	std::vector<Shard> shards;
+
+	/* Not the hash's low bits, which the shard's own map uses */
+	const Shard& shard_of(size_t hash) const { return shards[(hash >> 7) % shards.size()]; }
+	Shard& shard_of(size_t hash) { return shards[(hash >> 7) % shards.size()]; }
+
+public:
+	static constexpr std::uint32_t none = std::uint32_t(-1);
+
+	TagDictionary(size_t shard_count = 64);
+
+	/* Add tag, first seen at position (thread-safe) */
+	void insert(std::string_view tag, std::uint64_t position);
+
+	/*
+	 * Number the tags in order of the position they were first seen at,
+	 * returning the tags by id (call once all inserts are done)
+	 */
+	std::vector<std::string_view> assign_ids();
+
+	/* Id of tag, or none (thread-safe, after assign_ids) */
+	std::uint32_t find(std::string_view tag) const;
+
+	size_t size() const;
+};
+
+}
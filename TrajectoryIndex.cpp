@@ -0,0 +1,611 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "TrajectoryIndex.hpp"
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::unordered_map;
+using std::ifstream;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace mugloar
+{
+
+static constexpr string_view index_magic = "MUGIDX2\n";
+static constexpr string_view old_index_magic = "MUGIDX1\n";
+
+static constexpr size_t header_size = 64;
+
+static constexpr size_t event_record_size = 25;
+static constexpr size_t directory_header_size = 13;
+static constexpr size_t directory_entry_size = 28;
+
+/* Records since the last directory which make a new one worth writing (unless the last one is bigger) */
+static constexpr uint64_t directory_min_tail = 1 << 20;
+
+/* Log is scanned this much at a time when catching up */
+static constexpr size_t scan_chunk = 16 << 20;
+
+/* Bytes at each end of the indexed part of the log which are hashed */
+static constexpr size_t hash_window = 4096;
+
+static constexpr string_view turn_field = "\tgame:turn\t";
+
+/* Fixed-width little-endian integers (host is assumed little-endian, as in BinaryLog) */
+template <typename T>
+static void put(string& out, T x)
+{
+	char buf[sizeof(T)];
+	memcpy(buf, &x, sizeof(buf));
+	out.append(buf, sizeof(buf));
+}
+
+template <typename T>
+static T get(const char *p)
+{
+	T x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static size_t pread_all(int fd, char *buf, size_t size, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < size) {
+		auto res = ::pread(fd, buf + done, size - done, offset + done);
+		if (res == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error(string("Failed to read: ") + strerror(errno));
+		}
+		if (res == 0) {
+			break;
+		}
+		done += res;
+	}
+	return done;
+}
+
+static void pwrite_all(int fd, const string& data, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < data.size()) {
+		auto res = ::pwrite(fd, data.data() + done, data.size() - done, offset + done);
+		if (res == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error(string("Failed to write index: ") + strerror(errno));
+		}
+		done += res;
+	}
+}
+
+struct Header
+{
+	uint64_t log_bytes;
+	uint64_t index_bytes;
+	uint64_t log_hash;
+	uint64_t directory;
+	uint64_t games;
+	uint64_t events;
+	uint64_t longest;
+};
+
+static Header read_header(int fd, const string& filename)
+{
+	char buf[header_size];
+	if (pread_all(fd, buf, sizeof(buf), 0) != sizeof(buf) || string_view(buf, index_magic.size()) != index_magic) {
+		throw std::runtime_error("Invalid trajectory index: " + filename);
+	}
+	Header h;
+	h.log_bytes = get<uint64_t>(buf + 8);
+	h.index_bytes = get<uint64_t>(buf + 16);
+	h.log_hash = get<uint64_t>(buf + 24);
+	h.directory = get<uint64_t>(buf + 32);
+	h.games = get<uint64_t>(buf + 40);
+	h.events = get<uint64_t>(buf + 48);
+	h.longest = get<uint64_t>(buf + 56);
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		throw std::runtime_error(string("Failed to stat index: ") + strerror(errno));
+	}
+	if (h.index_bytes < header_size || h.index_bytes > uint64_t(st.st_size) || h.directory >= h.index_bytes) {
+		throw std::runtime_error("Truncated trajectory index: " + filename);
+	}
+	return h;
+}
+
+/* Number of games in the directory record at offset, and its size */
+static std::pair<uint32_t, uint64_t> read_directory_header(int fd, const string& filename, uint64_t offset)
+{
+	char buf[directory_header_size];
+	if (pread_all(fd, buf, sizeof(buf), offset) != sizeof(buf) || buf[0] != 'D') {
+		throw std::runtime_error("Invalid directory in trajectory index: " + filename);
+	}
+	const auto count = get<uint32_t>(buf + 1);
+	return { count, directory_header_size + uint64_t(count) * directory_entry_size + get<uint64_t>(buf + 5) };
+}
+
+/*
+ * Call func(type, record, offset) for each record of data, which starts at
+ * offset in the index file
+ */
+template <typename Func>
+static void for_each_record(const string& filename, string_view data, uint64_t offset, Func func)
+{
+	while (!data.empty()) {
+		const char type = data[0];
+		uint64_t size;
+		if (type == 'G' && data.size() >= 5) {
+			size = 5 + uint64_t(get<uint32_t>(data.data() + 1));
+		} else if (type == 'E') {
+			size = event_record_size;
+		} else if (type == 'D' && data.size() >= directory_header_size) {
+			size = directory_header_size + uint64_t(get<uint32_t>(data.data() + 1)) * directory_entry_size + get<uint64_t>(data.data() + 5);
+		} else {
+			throw std::runtime_error("Invalid record in trajectory index: " + filename);
+		}
+		if (data.size() < size) {
+			throw std::runtime_error("Truncated record in trajectory index: " + filename);
+		}
+		func(type, data.substr(1, size - 1), offset);
+		data.remove_prefix(size);
+		offset += size;
+	}
+}
+
+/* FNV-1a */
+static uint64_t hash(uint64_t h, string_view data)
+{
+	for (unsigned char c : data) {
+		h = (h ^ c) * 0x100000001b3;
+	}
+	return h;
+}
+
+/* Hash of the first and last hash_window bytes of the log's first size bytes */
+static uint64_t hash_log(string_view head, string_view tail)
+{
+	return hash(hash(0xcbf29ce484222325, head), tail);
+}
+
+static uint64_t hash_log(int log_fd, uint64_t size)
+{
+	const size_t n = std::min<uint64_t>(hash_window, size);
+	string head(n, '\0');
+	string tail(n, '\0');
+	if (pread_all(log_fd, head.data(), n, 0) != n || pread_all(log_fd, tail.data(), n, size - n) != n) {
+		throw std::runtime_error("Event log is shorter than its index");
+	}
+	return hash_log(head, tail);
+}
+
+string index_path(const string& log)
+{
+	return log + ".idx";
+}
+
+/* Writer */
+
+IndexWriter::IndexWriter(const string& log) :
+	log(log)
+{
+	const auto filename = index_path(log);
+	fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open trajectory index " + filename + ": " + strerror(errno));
+	}
+	try {
+		load();
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+}
+
+IndexWriter::~IndexWriter()
+{
+	close(fd);
+}
+
+void IndexWriter::write_header()
+{
+	string header(index_magic);
+	put<uint64_t>(header, log_bytes);
+	put<uint64_t>(header, index_bytes);
+	put<uint64_t>(header, log_hash);
+	put<uint64_t>(header, directory);
+	put<uint64_t>(header, game_ids.size());
+	put<uint64_t>(header, events);
+	put<uint64_t>(header, longest);
+	pwrite_all(fd, header, 0);
+}
+
+void IndexWriter::reset()
+{
+	if (ftruncate(fd, 0) == -1) {
+		throw std::runtime_error(string("Failed to truncate index: ") + strerror(errno));
+	}
+	game_ids.clear();
+	games.clear();
+	log_bytes = 0;
+	index_bytes = header_size;
+	log_hash = hash_log(string_view(), string_view());
+	directory = 0;
+	directory_bytes = 0;
+	events = 0;
+	longest = 0;
+	write_header();
+}
+
+uint64_t IndexWriter::directory_end() const
+{
+	return directory ? directory + directory_bytes : header_size;
+}
+
+void IndexWriter::load()
+{
+	const auto filename = index_path(log);
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		throw std::runtime_error(string("Failed to stat index: ") + strerror(errno));
+	}
+	if (st.st_size == 0) {
+		reset();
+		return;
+	}
+
+	/* Index of an older version: index the log again */
+	char magic[index_magic.size()];
+	if (pread_all(fd, magic, sizeof(magic), 0) == sizeof(magic) && string_view(magic, sizeof(magic)) == old_index_magic) {
+		reset();
+		return;
+	}
+
+	const auto header = read_header(fd, filename);
+	log_bytes = header.log_bytes;
+	index_bytes = header.index_bytes;
+	log_hash = header.log_hash;
+	directory = header.directory;
+	events = header.events;
+	longest = header.longest;
+
+	/* Games from the directory, then the records since */
+	if (directory) {
+		const auto [count, size] = read_directory_header(fd, filename, directory);
+		directory_bytes = size;
+		if (directory_end() > index_bytes) {
+			throw std::runtime_error("Truncated trajectory index: " + filename);
+		}
+		string data(size, '\0');
+		pread_all(fd, data.data(), size, directory);
+		const char *entry = data.data() + directory_header_size;
+		const char *names = entry + size_t(count) * directory_entry_size;
+		games.resize(count);
+		for (uint32_t i = 0; i < count; ++i, entry += directory_entry_size) {
+			const auto id = get<uint32_t>(entry + 12);
+			if (id >= count) {
+				throw std::runtime_error("Invalid directory in trajectory index: " + filename);
+			}
+			game_ids.emplace(string(names + get<uint64_t>(entry), get<uint32_t>(entry + 8)), id);
+			games[id] = { get<uint64_t>(entry + 16), get<uint32_t>(entry + 24) };
+		}
+	}
+	string data(index_bytes - directory_end(), '\0');
+	pread_all(fd, data.data(), data.size(), directory_end());
+	for_each_record(filename, data, directory_end(), [&] (char type, string_view record, uint64_t offset) {
+		if (type == 'G') {
+			game_ids.emplace(string(record.substr(4)), games.size());
+			games.emplace_back();
+		} else if (type == 'E') {
+			const auto id = get<uint32_t>(record.data());
+			if (id >= games.size()) {
+				throw std::runtime_error("Invalid game in trajectory index: " + filename);
+			}
+			games[id].last = offset;
+			++games[id].events;
+		}
+	});
+
+	/* Drop records of an interrupted update */
+	if (uint64_t(st.st_size) > index_bytes && ftruncate(fd, index_bytes) == -1) {
+		throw std::runtime_error(string("Failed to truncate index: ") + strerror(errno));
+	}
+}
+
+size_t IndexWriter::update()
+{
+	const int log_fd = ::open(log.c_str(), O_RDONLY | O_CLOEXEC);
+	if (log_fd == -1) {
+		throw std::runtime_error("Failed to open event log " + log + ": " + strerror(errno));
+	}
+
+	size_t added = 0;
+	try {
+		struct stat st;
+		if (fstat(log_fd, &st) == -1) {
+			throw std::runtime_error(string("Failed to stat event log: ") + strerror(errno));
+		}
+		const uint64_t size = st.st_size;
+
+		/* Log was truncated or replaced: start over */
+		if (size < log_bytes || (log_bytes > 0 && hash_log(log_fd, log_bytes) != log_hash)) {
+			reset();
+		}
+
+		string buf;
+		string records;
+		while (log_bytes < size) {
+			buf.resize(std::min<uint64_t>(scan_chunk, size - log_bytes));
+			buf.resize(pread_all(log_fd, buf.data(), buf.size(), log_bytes));
+
+			/* Only whole lines, the rest may still be being written */
+			const auto last = buf.rfind('\n');
+			if (last == string::npos) {
+				if (buf.size() == scan_chunk) {
+					throw std::runtime_error("Line too long in event log " + log);
+				}
+				break;
+			}
+
+			records.clear();
+			/* Games first seen in this batch, and games' new state, only applied once their records are written */
+			unordered_map<string, uint32_t> new_game_ids;
+			unordered_map<uint32_t, Game> new_games;
+			size_t new_events = 0;
+			string_view text(buf.data(), last + 1);
+			uint64_t offset = log_bytes;
+			while (!text.empty()) {
+				const auto end = text.find('\n');
+				const auto line = text.substr(0, end);
+				const auto tab = line.find('\t');
+				if (tab != string_view::npos) {
+					string game(line.substr(0, tab));
+					auto it = game_ids.find(game);
+					if (it == game_ids.end()) {
+						bool is_new;
+						std::tie(it, is_new) = new_game_ids.try_emplace(std::move(game), game_ids.size() + new_game_ids.size());
+						if (is_new) {
+							records.push_back('G');
+							put<uint32_t>(records, it->first.size());
+							records += it->first;
+						}
+					}
+					const auto id = it->second;
+					auto [state, is_new] = new_games.try_emplace(id);
+					if (is_new && id < games.size()) {
+						state->second = games[id];
+					}
+					uint32_t turn = 0;
+					const auto field = line.find(turn_field, tab);
+					if (field != string_view::npos) {
+						turn = std::strtoul(line.data() + field + turn_field.size(), nullptr, 10);
+					}
+					const uint64_t record = index_bytes + records.size();
+					records.push_back('E');
+					put<uint32_t>(records, id);
+					put<uint32_t>(records, turn);
+					put<uint64_t>(records, offset);
+					put<uint64_t>(records, state->second.last);
+					state->second.last = record;
+					++state->second.events;
+					++new_events;
+				}
+				offset += end + 1;
+				text.remove_prefix(end + 1);
+			}
+
+			/* Records first, then the header that makes them valid */
+			pwrite_all(fd, records, index_bytes);
+			game_ids.merge(new_game_ids);
+			games.resize(game_ids.size());
+			for (const auto& [id, game] : new_games) {
+				games[id] = game;
+				longest = std::max<uint64_t>(longest, game.events);
+			}
+			events += new_events;
+			added += new_events;
+			index_bytes += records.size();
+			log_bytes = offset;
+			log_hash = hash_log(log_fd, log_bytes);
+			write_header();
+		}
+	} catch (...) {
+		close(log_fd);
+		throw;
+	}
+	close(log_fd);
+
+	if (index_bytes - directory_end() > std::max(directory_bytes, directory_min_tail)) {
+		write_directory();
+	}
+
+	return added;
+}
+
+void IndexWriter::write_directory()
+{
+	if (index_bytes == directory_end()) {
+		return;
+	}
+
+	vector<std::pair<string_view, uint32_t>> sorted(game_ids.begin(), game_ids.end());
+	std::sort(sorted.begin(), sorted.end());
+
+	string entries;
+	string names;
+	for (const auto& [name, id] : sorted) {
+		put<uint64_t>(entries, names.size());
+		put<uint32_t>(entries, name.size());
+		put<uint32_t>(entries, id);
+		put<uint64_t>(entries, games[id].last);
+		put<uint32_t>(entries, games[id].events);
+		names += name;
+	}
+	string record(1, 'D');
+	put<uint32_t>(record, sorted.size());
+	put<uint64_t>(record, names.size());
+	record += entries;
+	record += names;
+
+	/* Record first, then the header that makes it the directory */
+	pwrite_all(fd, record, index_bytes);
+	directory = index_bytes;
+	directory_bytes = record.size();
+	index_bytes += record.size();
+	write_header();
+}
+
+/* Reader */
+
+TrajectoryIndex::TrajectoryIndex(const string& log) :
+	filename(index_path(log))
+{
+	fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		throw std::runtime_error("No trajectory index for " + log + " (run mugindex)");
+	}
+	try {
+		const auto header = read_header(fd, filename);
+		log_bytes = header.log_bytes;
+		log_hash = header.log_hash;
+		_games = header.games;
+		_events = header.events;
+		_longest = header.longest;
+
+		uint64_t tail = header_size;
+		if (header.directory) {
+			const auto [count, size] = read_directory_header(fd, filename, header.directory);
+			directory_count = count;
+			directory_entries = header.directory + directory_header_size;
+			directory_names = directory_entries + uint64_t(count) * directory_entry_size;
+			tail = header.directory + size;
+			if (tail > header.index_bytes) {
+				throw std::runtime_error("Truncated trajectory index: " + filename);
+			}
+		}
+
+		/* Records since the directory (games in it have the ids below its count) */
+		string data(header.index_bytes - tail, '\0');
+		pread_all(fd, data.data(), data.size(), tail);
+		for_each_record(filename, data, tail, [&] (char type, string_view record, uint64_t offset) {
+			if (type == 'G') {
+				tail_games.emplace(string(record.substr(4)), directory_count + tail_games.size());
+			} else if (type == 'E') {
+				tail_last[get<uint32_t>(record.data())] = offset;
+			}
+		});
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+}
+
+TrajectoryIndex::~TrajectoryIndex()
+{
+	close(fd);
+}
+
+bool TrajectoryIndex::find_directory(const string& game, uint32_t& id, uint64_t& last) const
+{
+	uint32_t lo = 0;
+	uint32_t hi = directory_count;
+	char entry[directory_entry_size];
+	string name;
+	while (lo < hi) {
+		const auto mid = lo + (hi - lo) / 2;
+		if (pread_all(fd, entry, sizeof(entry), directory_entries + uint64_t(mid) * directory_entry_size) != sizeof(entry)) {
+			throw std::runtime_error("Truncated trajectory index: " + filename);
+		}
+		name.resize(get<uint32_t>(entry + 8));
+		if (pread_all(fd, name.data(), name.size(), directory_names + get<uint64_t>(entry)) != name.size()) {
+			throw std::runtime_error("Truncated trajectory index: " + filename);
+		}
+		if (name < game) {
+			lo = mid + 1;
+		} else if (game < name) {
+			hi = mid;
+		} else {
+			id = get<uint32_t>(entry + 12);
+			last = get<uint64_t>(entry + 16);
+			return true;
+		}
+	}
+	return false;
+}
+
+vector<TrajectoryIndex::Event> TrajectoryIndex::find(const string& game) const
+{
+	vector<Event> events;
+	uint32_t id = 0;
+	uint64_t record = 0;
+	if (!find_directory(game, id, record)) {
+		auto it = tail_games.find(game);
+		if (it == tail_games.end()) {
+			return events;
+		}
+		id = it->second;
+	}
+	auto it = tail_last.find(id);
+	if (it != tail_last.end()) {
+		record = it->second;
+	}
+
+	/* Walk the game's events back from its last one */
+	char buf[event_record_size];
+	while (record) {
+		if (pread_all(fd, buf, sizeof(buf), record) != sizeof(buf) || buf[0] != 'E' || get<uint32_t>(buf + 1) != id) {
+			throw std::runtime_error("Invalid event in trajectory index: " + filename);
+		}
+		events.push_back({ get<uint32_t>(buf + 5), get<uint64_t>(buf + 9) });
+		const auto previous = get<uint64_t>(buf + 17);
+		if (previous >= record) {
+			throw std::runtime_error("Invalid event in trajectory index: " + filename);
+		}
+		record = previous;
+	}
+	std::reverse(events.begin(), events.end());
+
+	/* Log order within a game is already turn order unless shards were merged oddly */
+	std::stable_sort(events.begin(), events.end(), [] (const Event& a, const Event& b) { return a.turn < b.turn; });
+	return events;
+}
+
+vector<string_view> TrajectoryIndex::trajectory(const MappedFile& log, const string& game) const
+{
+	vector<string_view> lines;
+	const auto text = log.view();
+	if (text.size() < log_bytes) {
+		throw std::runtime_error("Trajectory index is newer than event log");
+	}
+	const size_t n = std::min<uint64_t>(hash_window, log_bytes);
+	if (hash_log(text.substr(0, n), text.substr(log_bytes - n, n)) != log_hash) {
+		throw std::runtime_error("Trajectory index is of another event log (run mugindex)");
+	}
+	const auto events = find(game);
+	lines.reserve(events.size());
+	for (const auto& event : events) {
+		auto line = text.substr(event.offset);
+		lines.push_back(line.substr(0, line.find('\n')));
+	}
+	return lines;
+}
+
+}
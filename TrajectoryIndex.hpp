@@ -0,0 +1,151 @@
+#pragma once
+/*
+ * Index of game trajectories in a text event log.
+ *
+ * Maps each game id to the byte offsets of its events, in turn order, so that
+ * a whole game can be fetched without scanning (or sorting) the log.  The
+ * index lives alongside the log as "<log>.idx", and is brought up to date by
+ * scanning only what was appended to the log since the last update.
+ *
+ * Index file layout (little-endian):
+ *
+ *   header:  "MUGIDX2\n", u64 log-bytes-indexed, u64 index-bytes-valid,
+ *            u64 log-hash, u64 directory, u64 games, u64 events, u64 longest
+ *
+ *   records: u8 'G', u32 length, bytes                (new game, ids count up from 0)
+ *            u8 'E', u32 game, u32 turn, u64 offset, u64 previous
+ *                                                     (event, previous: index offset of the game's previous 'E', or 0)
+ *            u8 'D', u32 count, u64 names-size, count * entry, names
+ *                                                     (directory of all games so far, sorted by name)
+ *
+ *   entry:   u64 name-offset, u32 name-length, u32 game, u64 last, u32 events
+ *                                                     (name-offset into names, last: index offset of the game's last 'E')
+ *
+ * A lookup binary searches the directory (the header's offset of the latest
+ * 'D', or 0) and follows the game's chain of 'E' records back from its last
+ * one, reading only those, after scanning the records appended since the
+ * directory.  A new directory is appended once those outgrow the last one,
+ * and by mugindex.
+ *
+ * log-hash is a hash of the first and last 4 KiB of the indexed part of the
+ * log, so that a log replaced by another one (even a bigger one) gets
+ * indexed from scratch.
+ *
+ * Records past index-bytes-valid (e.g. from an interrupted update) are
+ * discarded on the next update.
+ *
+ * Only text logs are indexed; binary logs are already grouped into blocks.
+ */
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+namespace mugloar
+{
+
+/* Path of the index file for a log file */
+std::string index_path(const std::string& log);
+
+/* Keeps the index of a log up to date (single writer) */
+class IndexWriter
+{
+	const std::string log;
+	int fd = -1;
+
+	std::uint64_t log_bytes = 0;
+	std::uint64_t index_bytes = 0;
+	std::uint64_t log_hash = 0;
+	std::uint64_t directory = 0;
+	std::uint64_t directory_bytes = 0;
+	std::uint64_t events = 0;
+	std::uint64_t longest = 0;
+
+	/* Game's last 'E' record and its number of events */
+	struct Game
+	{
+		std::uint64_t last = 0;
+		std::uint32_t events = 0;
+	};
+
+	std::unordered_map<std::string, std::uint32_t> game_ids;
+	std::vector<Game> games;
+
+	void reset();
+	void load();
+	void write_header();
+	std::uint64_t directory_end() const;
+
+public:
+	/* Opens (or creates) the index of the log */
+	IndexWriter(const std::string& log);
+
+	IndexWriter(const IndexWriter&) = delete;
+	IndexWriter& operator = (const IndexWriter&) = delete;
+
+	~IndexWriter();
+
+	/* Index whole lines appended to the log since the last update, returns number of events added */
+	size_t update();
+
+	/* Append a directory of all games, unless there are no records since the last one */
+	void write_directory();
+};
+
+/* Index opened for lookups, which only read the records they need */
+class TrajectoryIndex
+{
+public:
+	struct Event
+	{
+		std::uint32_t turn;
+		std::uint64_t offset;
+	};
+
+private:
+	const std::string filename;
+	int fd = -1;
+
+	std::uint64_t log_bytes = 0;
+	std::uint64_t log_hash = 0;
+	std::uint64_t _games = 0;
+	std::uint64_t _events = 0;
+	std::uint64_t _longest = 0;
+
+	/* Directory entries and names */
+	std::uint32_t directory_count = 0;
+	std::uint64_t directory_entries = 0;
+	std::uint64_t directory_names = 0;
+
+	/* Records since the directory: games first seen there, and last 'E' of each game */
+	std::unordered_map<std::string, std::uint32_t> tail_games;
+	std::unordered_map<std::uint32_t, std::uint64_t> tail_last;
+
+	/* Game id and last 'E' record from the directory, false if not there */
+	bool find_directory(const std::string& game, std::uint32_t& id, std::uint64_t& last) const;
+
+public:
+	/* Opens the index of the log (see IndexWriter to create/update it) */
+	TrajectoryIndex(const std::string& log);
+
+	TrajectoryIndex(const TrajectoryIndex&) = delete;
+	TrajectoryIndex& operator = (const TrajectoryIndex&) = delete;
+
+	~TrajectoryIndex();
+
+	size_t games() const { return _games; }
+	size_t events() const { return _events; }
+	/* Events of the longest game */
+	size_t longest() const { return _longest; }
+
+	/* Events of the game in turn order (none if not in the index) */
+	std::vector<Event> find(const std::string& game) const;
+
+	/* Lines of the game's events (from the mapped log), in turn order */
+	std::vector<std::string_view> trajectory(const MappedFile& log, const std::string& game) const;
+};
+
+}
@@ -31,7 +31,8 @@ using mugloar::Probability;
 
 static void help()
 {
-	cerr << "No parameters expected" << endl;
+	cerr << "Arguments:" << endl;
+	cerr << "  -k risk-table-filename (success probabilities fitted by mugfit, default: built-in)" << endl;
 }
 
 static string risk_str(Probability p)
@@ -63,10 +64,12 @@ int main(int argc, char *argv[])
 {
 	init_locale();
 
+	const char *riskfilename = nullptr;
 	char c;
-	while ((c = getopt(argc, argv, "h")) != -1) {
+	while ((c = getopt(argc, argv, "hk:")) != -1) {
 		switch (c) {
 		case 'h': help(); return 1;
+		case 'k': riskfilename = optarg; break;
 		case '?': help(); return 1;
 		}
 	}
@@ -76,6 +79,10 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (riskfilename) {
+		mugloar::load_probability_risk(riskfilename);
+	}
+
 	mugloar::Api api;
 
 	bool quit = false;
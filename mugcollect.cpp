@@ -7,6 +7,7 @@
 #include <random>
 #include <mutex>
 #include <iostream>
+#include <memory>
 #include <fstream>
 #include <vector>
 #include <string>
@@ -45,18 +46,21 @@ using std::get;
 using namespace mugloar;
 
 /* Output file for event log */
-static ofstream outfile;
+static std::unique_ptr<EventLog> outfile;
 
 /* API binding */
 static const Api api;
 
+/* Maximum number of hashed state x action cross features per event (0 = off) */
+static size_t max_crosses = 0;
+
 /* One worker (automated player) */
 static void worker_task()
 {
 	random_device rd;
 	mt19937 prng(rd());
 
-	vector<pair<function<void()>, function<void()>>> actions;
+	vector<pair<function<void()>, function<FeatureCache::Value()>>> actions;
 	actions.reserve(100);
 
 	while (!stopping) {
@@ -82,7 +86,7 @@ static void worker_task()
 			for (const auto& msg : game.messages()) {
 				actions.push_back({
 					[&] () { game.solve_message(msg); },
-					[&] () { extract_action_features(features, msg); }
+					[&] () { return action_features(msg); }
 					});
 			}
 
@@ -90,7 +94,7 @@ static void worker_task()
 			for (const auto& item : game.shop_items()) {
 				actions.push_back({
 					[&] () { game.purchase_item(item); },
-					[&] () { extract_action_features(features, item); }
+					[&] () { return action_features(item); }
 					});
 			}
 
@@ -99,7 +103,14 @@ static void worker_task()
 			const auto& [action, get_features] = actions[action_idx];
 
 			/* Get action features */
-			get_features();
+			const auto chosen_features = get_features();
+			for (const auto& [feature, value] : *chosen_features) {
+				features[feature] = value;
+			}
+
+			/* Cross action with pre-action state */
+			CrossFeatures cross;
+			extract_cross_features(cross, CrossState(pre), *chosen_features, max_crosses);
 
 			/* Execute action */
 			try {
@@ -118,7 +129,7 @@ static void worker_task()
 			extract_game_diff_state(features, diff);
 
 			/* Emit action features and state change */
-			log_event(outfile, game, features);
+			log_event(*outfile, game, features, cross);
 
 			/* This post-action state is the next iteration's pre-action state */
 			pre = post;
@@ -132,7 +143,13 @@ static void help()
 {
 	cerr << "Arguments:" << endl;
 	cerr << "  -o output-filename" << endl;
+	cerr << "  -b (write binary event log)" << endl;
+	cerr << "  -w (write a shard per worker, output-filename is a directory)" << endl;
+	cerr << "  -d event-log-durability (write|sync, default: write)" << endl;
+	cerr << "  -I (keep a trajectory index of the text event log, see mugindex)" << endl;
+	cerr << "  -R sample-size (only keep a sample of this many events per action/probability/turn stratum)" << endl;
 	cerr << "  -p worker-count" << endl;
+	cerr << "  -x max-cross-features (default: 0, disabled)" << endl;
 }
 
 int main(int argc, char *argv[])
@@ -142,11 +159,18 @@ int main(int argc, char *argv[])
 	char c;
 	int worker_count = 4;
 	const char *outfilename = nullptr;
-	while ((c = getopt(argc, argv, "hp:o:")) != -1) {
+	EventLog::Options log_options;
+	while ((c = getopt(argc, argv, "hp:o:x:bwd:IR:")) != -1) {
 		switch (c) {
 		case 'h': help(); return 1;
 		case 'p': worker_count = std::atoi(optarg); break;
 		case 'o': outfilename = optarg; break;
+		case 'b': log_options.binary = true; break;
+		case 'w': log_options.sharded = true; break;
+		case 'd': log_options.durability = parse_durability(optarg); break;
+		case 'I': log_options.index = true; break;
+		case 'R': log_options.sample_size = std::stoul(optarg); break;
+		case 'x': max_crosses = std::stoul(optarg); break;
 		case '?': help(); return 1;
 		}
 	}
@@ -157,9 +181,12 @@ int main(int argc, char *argv[])
 	}
 
 	/* Open output file */
-	outfile = ofstream(outfilename, std::ios::binary | std::ios_base::app);
+	outfile = std::make_unique<EventLog>(outfilename, log_options);
 
 	/* Start workers */
 	run_parallel(worker_count, [&] () { worker_task(); });
 
+	action_feature_cache().print_stats(cerr);
+	cerr << endl;
+
 }
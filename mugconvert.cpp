@@ -0,0 +1,223 @@
+/*
+ * Converts event logs between the text (TSV) format and the binary columnar
+ * format (see BinaryLog.hpp).  Direction is decided by the input's format.
+ */
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <getopt.h>
+
+#include "Locale.hpp"
+#include "BinaryLog.hpp"
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::ifstream;
+using std::ofstream;
+using std::cerr;
+using std::endl;
+using std::getline;
+using std::uint64_t;
+using namespace mugloar;
+
+/* Parse a line of the text log, false if it's malformed */
+static bool parse_text_event(const string& line, string& game, uint64_t& time, FeatureList& features)
+{
+	string_view sv(line);
+	string_view::size_type end;
+	/* First field is game id, the rest are key/value pairs */
+	if ((end = sv.find('\t')) == string_view::npos) {
+		return false;
+	}
+	game = sv.substr(0, end);
+	sv.remove_prefix(end + 1);
+	features.clear();
+	/* Text log only has timestamps if it came from a shard */
+	time = 0;
+	while ((end = sv.find('\t')) != string_view::npos) {
+		string key(sv.substr(0, end));
+		sv.remove_prefix(end + 1);
+		if ((end = sv.find('\t')) == string_view::npos) {
+			break;
+		}
+		if (key == meta_time) {
+			time = std::stoull(string(sv.substr(0, end)));
+		} else {
+			features.emplace_back(std::move(key), std::stof(string(sv.substr(0, end))));
+		}
+		sv.remove_prefix(end + 1);
+	}
+	return true;
+}
+
+/* Text to binary, returns number of events */
+static size_t text_to_binary(ifstream& in, ofstream& out, size_t block_events)
+{
+	BinaryLogWriter writer(out, block_events);
+	string game;
+	uint64_t time;
+	FeatureList features;
+	size_t events = 0;
+
+	string line;
+	while (getline(in, line)) {
+		if (!parse_text_event(line, game, time, features)) {
+			cerr << "Invalid line #" << (events + 1) << " ignored" << endl;
+			continue;
+		}
+		writer.write(game, time, features);
+		++events;
+	}
+
+	return events;
+}
+
+/* Binary to text, returns number of events */
+static size_t binary_to_text(ifstream& in, ofstream& out)
+{
+	BinaryLogReader reader(in);
+	EventBlock block;
+	size_t events = 0;
+
+	while (reader.next(block)) {
+		const auto& games = reader.game_names();
+		const auto& names = reader.feature_names();
+		for (size_t i = 0; i < block.size(); ++i) {
+			out << games[block.game[i]] << "\t";
+			if (block.time[i] != 0) {
+				out << meta_time << "\t" << block.time[i] << "\t";
+			}
+			for (auto j = block.offsets[i]; j < block.offsets[i + 1]; ++j) {
+				out << names[block.features[j]] << "\t" << block.values[j] << "\t";
+			}
+			out << "\n";
+		}
+		events += block.size();
+	}
+
+	return events;
+}
+
+/*
+ * Read text and binary logs side by side, returning the number of events
+ * which differ (game, time or features), counting events which only one of
+ * them has as different
+ */
+static size_t compare_logs(ifstream& text, ifstream& binary)
+{
+	BinaryLogReader reader(binary);
+	EventBlock block;
+	size_t index = 0;
+	string game;
+	uint64_t time;
+	FeatureList features;
+	size_t events = 0;
+	size_t mismatches = 0;
+
+	string line;
+	while (getline(text, line)) {
+		if (!parse_text_event(line, game, time, features)) {
+			continue;
+		}
+		++events;
+		if (index == block.size()) {
+			index = 0;
+			if (!reader.next(block)) {
+				block.clear();
+				++mismatches;
+				continue;
+			}
+		}
+		const auto& names = reader.feature_names();
+		bool same = reader.game_names()[block.game[index]] == game && block.time[index] == time && block.offsets[index + 1] - block.offsets[index] == features.size();
+		for (auto j = block.offsets[index]; same && j < block.offsets[index + 1]; ++j) {
+			const auto& [name, value] = features[j - block.offsets[index]];
+			same = names[block.features[j]] == name && block.values[j] == value;
+		}
+		if (!same) {
+			if (mismatches == 0) {
+				cerr << "First difference at event #" << events << " (game " << game << ", time " << time << " vs " << block.time[index] << ")" << endl;
+			}
+			++mismatches;
+		}
+		++index;
+	}
+	mismatches += block.size() - index;
+	while (reader.next(block)) {
+		mismatches += block.size();
+	}
+
+	return mismatches;
+}
+
+static void help()
+{
+	cerr << "Arguments:" << endl;
+	cerr << "  -i input-filename (text or binary event log)" << endl;
+	cerr << "  -o output-filename (binary if input is text, and vice versa)" << endl;
+	cerr << "  -b block-events (events per block of binary output, default: 4096)" << endl;
+	cerr << "  -c (check: read both logs back and compare every event)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	init_locale();
+
+	const char *infilename = nullptr;
+	const char *outfilename = nullptr;
+	size_t block_events = 4096;
+	bool check = false;
+	char c;
+	while ((c = getopt(argc, argv, "hi:o:b:c")) != -1) {
+		switch (c) {
+		case 'h': help(); return 1;
+		case 'i': infilename = optarg; break;
+		case 'o': outfilename = optarg; break;
+		case 'b': block_events = std::stoul(optarg); break;
+		case 'c': check = true; break;
+		case '?': help(); return 1;
+		}
+	}
+
+	if (!infilename || !outfilename || block_events == 0 || optind != argc) {
+		help();
+		return 1;
+	}
+
+	const bool binary = is_binary_log(infilename);
+
+	ifstream in(infilename, std::ios::binary);
+	ofstream out(outfilename, std::ios::binary | std::ios_base::trunc);
+	if (!in || !out) {
+		cerr << "Failed to open files" << endl;
+		return 1;
+	}
+
+	cerr << "Converting " << (binary ? "binary" : "text") << " log " << infilename << " to " << (binary ? "text" : "binary") << " log " << outfilename << "..." << endl;
+
+	const auto events = binary ? binary_to_text(in, out) : text_to_binary(in, out, block_events);
+
+	out.flush();
+	in.clear();
+	const auto in_size = in.seekg(0, std::ios::end).tellg();
+	const auto out_size = out.tellp();
+	cerr << "Events: " << events << endl;
+	cerr << "Size: " << in_size << " => " << out_size << " bytes" << endl;
+
+	if (check) {
+		out.close();
+		ifstream text(binary ? outfilename : infilename, std::ios::binary);
+		ifstream bin(binary ? infilename : outfilename, std::ios::binary);
+		cerr << "Checking..." << endl;
+		const auto mismatches = compare_logs(text, bin);
+		if (mismatches) {
+			cerr << mismatches << " events differ" << endl;
+			return 1;
+		}
+		cerr << "All events match" << endl;
+	}
+}
@@ -0,0 +1,673 @@
+/*
+ * Fits the game's hidden mission-success model to the solve events of an event
+ * log, by maximum likelihood.
+ *
+ * The README guesses that the backend's success probability is something like
+ * p_enum * (level + bias) / turn.  A probability can't grow without bound, so
+ * we fit the same shape on the odds:
+ *
+ *   odds(success) = odds(p_enum) * ((level + bias) / turn) ^ exponent
+ *
+ * i.e. logistic regression with linear predictor
+ *
+ *   z = a_enum + exponent * (log(level + bias) - log(turn)),  p_enum = 1 / (1 + exp(-a_enum))
+ *
+ * so p_enum is the success probability when level + bias = turn.  Parameters
+ * are a_enum per probability enum, log(bias) (keeping bias positive) and the
+ * exponent.
+ *
+ * The likelihood only depends on the events through the number of successes
+ * and trials of each (enum, level, turn) cell, so the log is reduced to those
+ * (in parallel, in one pass) and millions of events become thousands of cells.
+ * The fit is Newton's method (Levenberg-Marquardt damped), evaluating the
+ * gradient and observed information over the cells on all threads; confidence
+ * intervals come from the inverse of the observed information.
+ *
+ * The resulting table can be loaded by the players in place of the built-in
+ * risk values (see load_probability_risk in Game.hpp).
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <getopt.h>
+
+#include "Locale.hpp"
+#include "ExtractFeatures.hpp"
+#include "Game.hpp"
+#include "LogReader.hpp"
+#include "Parallel.hpp"
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::unordered_map;
+using std::pair;
+using std::ofstream;
+using std::cerr;
+using std::endl;
+using std::setw;
+using std::uint32_t;
+using std::uint64_t;
+using std::chrono::steady_clock;
+using mugloar::LogReader;
+using mugloar::EventView;
+using mugloar::FieldValue;
+using mugloar::Probability;
+using mugloar::reverse_lookup_probability;
+
+/* Number of threads for parsing and fitting */
+static unsigned thread_count = default_thread_count();
+
+static constexpr size_t enum_count = mugloar::IMPOSSIBLE + 1;
+
+/* Parameters: a_enum for each enum, then log(bias), then exponent */
+static constexpr size_t param_count = enum_count + 2;
+static constexpr size_t log_bias_param = enum_count;
+static constexpr size_t exponent_param = enum_count + 1;
+
+/* Cells are evaluated this many at a time, in independent accumulators which the compiler can keep in vector registers */
+static constexpr size_t lanes = 4;
+
+/* Cells per parallel task */
+static constexpr size_t block_size = 4096;
+
+/* Two-sided 95% quantile of the normal distribution */
+static constexpr double z95 = 1.959964;
+
+struct FitOptions
+{
+	size_t max_iterations = 100;
+	/* Weak Gaussian prior on each a_enum, so an enum which never failed (or never succeeded) still has a finite fit */
+	double ridge = 1e-2;
+	double initial_bias = 20;
+	double initial_exponent = 1;
+};
+
+static FitOptions fit_options;
+
+/*
+ * Successes and trials of each (enum, level, turn) cell, structure-of-arrays,
+ * sorted by enum then level then turn.  Each enum's cells are padded with
+ * empty cells (no trials) to a multiple of lanes, so evaluation needs no tail
+ * loop.
+ */
+struct Cells
+{
+	/* Distinct levels, ascending */
+	vector<double> levels;
+
+	/* Index into levels of each cell */
+	vector<uint32_t> level;
+	vector<double> log_turn;
+	vector<double> successes;
+	vector<double> trials;
+
+	/* Cells [begin[e], begin[e + 1]) are of enum e */
+	vector<size_t> begin;
+
+	/* Total trials of each enum */
+	vector<double> enum_trials;
+
+	size_t size() const { return trials.size(); }
+};
+
+/* Cell key: enum, level and turn, packed so that keys sort as the cells do */
+static uint64_t cell_key(size_t e, uint64_t level, uint64_t turn)
+{
+	constexpr uint64_t max = (uint64_t(1) << 24) - 1;
+	return uint64_t(e) << 48 | std::min(level, max) << 24 | std::min(turn, max);
+}
+
+struct CellCount
+{
+	double successes = 0;
+	double trials = 0;
+};
+
+/*
+ * Reduce the solve events of the log to cells.  A solve succeeded if it didn't
+ * cost a life.  Chunks are counted in parallel and merged in order.
+ */
+static Cells read_cells(const LogReader& log)
+{
+	unordered_map<string_view, size_t> enums;
+	for (size_t e = 0; e < enum_count; ++e) {
+		enums.emplace(reverse_lookup_probability(Probability(e)), e);
+	}
+
+	const string_view probability_prefix("probability:");
+	const string_view meta_weight(mugloar::meta_weight);
+
+	const auto chunks = log.chunks(thread_count * 8);
+
+	cerr << "Reading solve events from " << chunks.size() << " chunks on " << thread_count << " threads..." << endl;
+	vector<unordered_map<uint64_t, CellCount>> chunk_cells(chunks.size());
+	vector<size_t> chunk_unknown(chunks.size());
+	parallel_for(chunks.size(), thread_count, [&] (size_t i) {
+		auto& cells = chunk_cells[i];
+		log.for_each_event(chunks[i], [&] (const EventView& event) {
+			bool solve = false;
+			string_view probability;
+			float level = 0;
+			float turn = 1;
+			float lives = 0;
+			float weight = 1;
+			event.for_each_feature([&] (const string_view& tag, const FieldValue& value) {
+				if (tag == "action:solve") {
+					solve = true;
+				} else if (tag.substr(0, probability_prefix.size()) == probability_prefix) {
+					probability = tag.substr(probability_prefix.size());
+				} else if (tag == "game:level") {
+					level = value;
+				} else if (tag == "game:turn") {
+					turn = value;
+				} else if (tag == "diff:lives") {
+					lives = value;
+				} else if (tag == meta_weight) {
+					weight = value;
+				}
+			});
+			if (!solve) {
+				return;
+			}
+			const auto it = enums.find(probability);
+			if (it == enums.end()) {
+				++chunk_unknown[i];
+				return;
+			}
+			auto& cell = cells[cell_key(it->second, uint64_t(std::max(0.0f, std::round(level))), uint64_t(std::max(1.0f, std::round(turn))))];
+			cell.trials += weight;
+			if (lives >= 0) {
+				cell.successes += weight;
+			}
+		});
+	});
+
+	unordered_map<uint64_t, CellCount> merged;
+	size_t unknown = 0;
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		for (const auto& [key, count] : chunk_cells[i]) {
+			auto& cell = merged[key];
+			cell.successes += count.successes;
+			cell.trials += count.trials;
+		}
+		unordered_map<uint64_t, CellCount>().swap(chunk_cells[i]);
+		unknown += chunk_unknown[i];
+	}
+	if (unknown) {
+		cerr << unknown << " solve events without a known probability ignored" << endl;
+	}
+
+	vector<pair<uint64_t, CellCount>> sorted(merged.begin(), merged.end());
+	std::sort(sorted.begin(), sorted.end(), [] (const auto& a, const auto& b) { return a.first < b.first; });
+
+	Cells out;
+	for (const auto& [key, count] : sorted) {
+		out.levels.push_back(double(key >> 24 & 0xffffff));
+	}
+	std::sort(out.levels.begin(), out.levels.end());
+	out.levels.erase(std::unique(out.levels.begin(), out.levels.end()), out.levels.end());
+	if (out.levels.empty()) {
+		out.levels.push_back(0);
+	}
+
+	out.enum_trials.assign(enum_count, 0);
+	size_t next = 0;
+	for (size_t e = 0; e < enum_count; ++e) {
+		out.begin.push_back(out.size());
+		for (; next < sorted.size() && sorted[next].first >> 48 == e; ++next) {
+			const auto& [key, count] = sorted[next];
+			const auto level = double(key >> 24 & 0xffffff);
+			out.level.push_back(std::lower_bound(out.levels.begin(), out.levels.end(), level) - out.levels.begin());
+			out.log_turn.push_back(std::log(double(key & 0xffffff)));
+			out.successes.push_back(count.successes);
+			out.trials.push_back(count.trials);
+			out.enum_trials[e] += count.trials;
+		}
+		while (out.size() % lanes) {
+			out.level.push_back(0);
+			out.log_turn.push_back(0);
+			out.successes.push_back(0);
+			out.trials.push_back(0);
+		}
+	}
+	out.begin.push_back(out.size());
+
+	return out;
+}
+
+/* Log-likelihood, its gradient and the observed information (minus its Hessian), row-major */
+struct Evaluation
+{
+	double loglik = 0;
+	vector<double> gradient = vector<double>(param_count, 0);
+	vector<double> information = vector<double>(param_count * param_count, 0);
+};
+
+/* Sums over a block of cells of one enum */
+struct BlockSums
+{
+	double loglik = 0;
+	double g_a = 0, g_b = 0, g_g = 0;
+	double i_aa = 0, i_ab = 0, i_ag = 0, i_bb = 0, i_bg = 0, i_gg = 0;
+};
+
+/*
+ * With u = log(level + bias) - log(turn), q = bias / (level + bias) and
+ * b = log(bias), each cell of s successes in n trials contributes
+ *
+ *   loglik = s * z - n * log(1 + exp(z))
+ *   dz/da = 1,  dz/db = exponent * q,  dz/dexponent = u
+ *   d2z/db2 = exponent * q * (1 - q),  d2z/db dexponent = q
+ *
+ * and by the chain rule, with r = s - n * p and w = n * p * (1 - p),
+ * gradient = r * dz, information = w * dz dz' - r * d2z.
+ */
+static BlockSums evaluate_block(const Cells& cells, size_t begin, size_t end, double a, double exponent, const vector<double>& log_level, const vector<double>& q_level)
+{
+	double loglik[lanes] = { }, g_a[lanes] = { }, g_b[lanes] = { }, g_g[lanes] = { };
+	double i_aa[lanes] = { }, i_ab[lanes] = { }, i_ag[lanes] = { }, i_bb[lanes] = { }, i_bg[lanes] = { }, i_gg[lanes] = { };
+
+	const auto *level = cells.level.data();
+	const auto *log_turn = cells.log_turn.data();
+	const auto *successes = cells.successes.data();
+	const auto *trials = cells.trials.data();
+	for (size_t i = begin; i < end; i += lanes) {
+		for (size_t j = 0; j < lanes; ++j) {
+			const auto k = i + j;
+			const auto u = log_level[level[k]] - log_turn[k];
+			const auto q = q_level[level[k]];
+			const auto z = a + exponent * u;
+			/* Numerically stable sigmoid and log(1 + exp(z)) */
+			const auto e = std::exp(-std::abs(z));
+			const auto p = (z >= 0 ? 1 : e) / (1 + e);
+			const auto softplus = std::max(z, 0.0) + std::log1p(e);
+			const auto s = successes[k];
+			const auto n = trials[k];
+			const auto r = s - n * p;
+			const auto w = n * p * (1 - p);
+			const auto dz_b = exponent * q;
+			loglik[j] += s * z - n * softplus;
+			g_a[j] += r;
+			g_b[j] += r * dz_b;
+			g_g[j] += r * u;
+			i_aa[j] += w;
+			i_ab[j] += w * dz_b;
+			i_ag[j] += w * u;
+			i_bb[j] += w * dz_b * dz_b - r * exponent * q * (1 - q);
+			i_bg[j] += w * dz_b * u - r * q;
+			i_gg[j] += w * u * u;
+		}
+	}
+
+	BlockSums out;
+	for (size_t j = 0; j < lanes; ++j) {
+		out.loglik += loglik[j];
+		out.g_a += g_a[j];
+		out.g_b += g_b[j];
+		out.g_g += g_g[j];
+		out.i_aa += i_aa[j];
+		out.i_ab += i_ab[j];
+		out.i_ag += i_ag[j];
+		out.i_bb += i_bb[j];
+		out.i_bg += i_bg[j];
+		out.i_gg += i_gg[j];
+	}
+	return out;
+}
+
+/* Block of cells of one enum, a parallel task */
+struct Block
+{
+	size_t e;
+	size_t begin;
+	size_t end;
+};
+
+static vector<Block> make_blocks(const Cells& cells)
+{
+	vector<Block> blocks;
+	for (size_t e = 0; e < enum_count; ++e) {
+		for (auto i = cells.begin[e]; i < cells.begin[e + 1]; i += block_size) {
+			blocks.push_back({ e, i, std::min(i + block_size, cells.begin[e + 1]) });
+		}
+	}
+	return blocks;
+}
+
+/* Evaluate the (penalised) log-likelihood at params, blocks on all threads, summed in order */
+static Evaluation evaluate(const Cells& cells, const vector<Block>& blocks, const vector<double>& params)
+{
+	const auto bias = std::exp(params[log_bias_param]);
+	const auto exponent = params[exponent_param];
+
+	/* Terms which only depend on the level, once per distinct level */
+	vector<double> log_level(cells.levels.size());
+	vector<double> q_level(cells.levels.size());
+	for (size_t l = 0; l < cells.levels.size(); ++l) {
+		log_level[l] = std::log(cells.levels[l] + bias);
+		q_level[l] = bias / (cells.levels[l] + bias);
+	}
+
+	vector<BlockSums> sums(blocks.size());
+	parallel_for(blocks.size(), thread_count, [&] (size_t t) {
+		const auto& block = blocks[t];
+		sums[t] = evaluate_block(cells, block.begin, block.end, params[block.e], exponent, log_level, q_level);
+	});
+
+	Evaluation out;
+	auto& g = out.gradient;
+	auto info = [&] (size_t i, size_t j) -> double& { return out.information[i * param_count + j]; };
+	constexpr auto b = log_bias_param;
+	constexpr auto x = exponent_param;
+	for (size_t t = 0; t < blocks.size(); ++t) {
+		const auto e = blocks[t].e;
+		const auto& s = sums[t];
+		out.loglik += s.loglik;
+		g[e] += s.g_a;
+		g[b] += s.g_b;
+		g[x] += s.g_g;
+		info(e, e) += s.i_aa;
+		info(e, b) += s.i_ab;
+		info(e, x) += s.i_ag;
+		info(b, b) += s.i_bb;
+		info(b, x) += s.i_bg;
+		info(x, x) += s.i_gg;
+	}
+	for (size_t e = 0; e < enum_count; ++e) {
+		out.loglik -= fit_options.ridge / 2 * params[e] * params[e];
+		g[e] -= fit_options.ridge * params[e];
+		info(e, e) += fit_options.ridge;
+	}
+	/* Symmetric */
+	for (size_t i = 0; i < param_count; ++i) {
+		for (size_t j = 0; j < i; ++j) {
+			info(i, j) = info(j, i);
+		}
+	}
+	return out;
+}
+
+/* Solve a x = b by Gaussian elimination with partial pivoting (a is n*n row-major), false if singular */
+static bool solve(vector<double> a, vector<double> b, vector<double>& x)
+{
+	const auto n = b.size();
+	for (size_t c = 0; c < n; ++c) {
+		size_t pivot = c;
+		for (size_t r = c + 1; r < n; ++r) {
+			if (std::abs(a[r * n + c]) > std::abs(a[pivot * n + c])) {
+				pivot = r;
+			}
+		}
+		if (!(std::abs(a[pivot * n + c]) > 0)) {
+			return false;
+		}
+		if (pivot != c) {
+			for (size_t k = 0; k < n; ++k) {
+				std::swap(a[c * n + k], a[pivot * n + k]);
+			}
+			std::swap(b[c], b[pivot]);
+		}
+		for (size_t r = c + 1; r < n; ++r) {
+			const auto f = a[r * n + c] / a[c * n + c];
+			for (size_t k = c; k < n; ++k) {
+				a[r * n + k] -= f * a[c * n + k];
+			}
+			b[r] -= f * b[c];
+		}
+	}
+	x.assign(n, 0);
+	for (size_t c = n; c-- > 0; ) {
+		double sum = b[c];
+		for (size_t k = c + 1; k < n; ++k) {
+			sum -= a[c * n + k] * x[k];
+		}
+		x[c] = sum / a[c * n + c];
+	}
+	return true;
+}
+
+struct Fit
+{
+	vector<double> params;
+	/* Inverse of the observed information, row-major (NaN if singular) */
+	vector<double> covariance;
+	double loglik;
+	size_t iterations;
+	bool converged;
+};
+
+/*
+ * Newton's method, damped Levenberg-Marquardt style: far from the optimum the
+ * observed information needn't be positive definite, so steps which don't
+ * improve the likelihood are retried with a larger multiple of its diagonal
+ * added, and the damping is relaxed again after each successful step.
+ */
+static Fit fit_model(const Cells& cells)
+{
+	const auto blocks = make_blocks(cells);
+
+	Fit fit;
+	fit.params.assign(param_count, 0);
+	for (size_t e = 0; e < enum_count; ++e) {
+		/* Start from each enum's overall success rate (clamped, for enums which always or never succeed) */
+		double s = 0;
+		for (auto i = cells.begin[e]; i < cells.begin[e + 1]; ++i) {
+			s += cells.successes[i];
+		}
+		const auto rate = std::clamp((s + 0.5) / (cells.enum_trials[e] + 1), 0.01, 0.99);
+		fit.params[e] = std::log(rate / (1 - rate));
+	}
+	fit.params[log_bias_param] = std::log(fit_options.initial_bias);
+	fit.params[exponent_param] = fit_options.initial_exponent;
+
+	auto current = evaluate(cells, blocks, fit.params);
+	cerr << "Fitting " << param_count << " parameters to " << cells.size() << " cells on " << thread_count << " threads..." << endl;
+	cerr << "  initial log-likelihood " << current.loglik << endl;
+
+	double damping = 1e-3;
+	fit.converged = false;
+	for (fit.iterations = 1; fit.iterations <= fit_options.max_iterations && !fit.converged; ++fit.iterations) {
+		while (true) {
+			auto a = current.information;
+			for (size_t i = 0; i < param_count; ++i) {
+				a[i * param_count + i] += damping * (std::abs(a[i * param_count + i]) + 1e-9);
+			}
+			vector<double> step;
+			auto trial = fit.params;
+			const bool ok = solve(a, current.gradient, step);
+			if (ok) {
+				for (size_t i = 0; i < param_count; ++i) {
+					trial[i] += step[i];
+				}
+			}
+			const auto next = ok ? evaluate(cells, blocks, trial) : Evaluation();
+			if (ok && std::isfinite(next.loglik) && next.loglik >= current.loglik) {
+				double max_step = 0;
+				for (const auto s : step) {
+					max_step = std::max(max_step, std::abs(s));
+				}
+				fit.converged = max_step < 1e-8 || next.loglik - current.loglik < 1e-12 * std::abs(current.loglik);
+				fit.params = trial;
+				current = next;
+				damping = std::max(damping / 10, 1e-12);
+				break;
+			}
+			damping *= 10;
+			if (damping > 1e12) {
+				/* No step improves on this, so it's as good as it gets */
+				fit.converged = true;
+				break;
+			}
+		}
+		cerr << "  iteration " << fit.iterations << ": log-likelihood " << current.loglik << ", bias " << std::exp(fit.params[log_bias_param]) << ", exponent " << fit.params[exponent_param] << endl;
+	}
+	--fit.iterations;
+	fit.loglik = current.loglik;
+
+	/* Covariance from the undamped information at the optimum, column by column */
+	fit.covariance.assign(param_count * param_count, std::numeric_limits<double>::quiet_NaN());
+	for (size_t c = 0; c < param_count; ++c) {
+		vector<double> unit(param_count, 0);
+		unit[c] = 1;
+		vector<double> column;
+		if (!solve(current.information, unit, column)) {
+			cerr << "Observed information is singular, no confidence intervals" << endl;
+			break;
+		}
+		for (size_t r = 0; r < param_count; ++r) {
+			fit.covariance[r * param_count + c] = column[r];
+		}
+	}
+
+	return fit;
+}
+
+/* Estimate and 95% confidence interval */
+struct Estimate
+{
+	double value;
+	double low;
+	double high;
+};
+
+static double sigmoid(double z)
+{
+	return 1 / (1 + std::exp(-z));
+}
+
+/* Interval of f(param), for monotone increasing f */
+template <typename Func>
+static Estimate estimate(const Fit& fit, size_t param, Func f)
+{
+	const auto x = fit.params[param];
+	const auto variance = fit.covariance[param * param_count + param];
+	const auto se = variance >= 0 ? std::sqrt(variance) : std::numeric_limits<double>::quiet_NaN();
+	return { f(x), f(x - z95 * se), f(x + z95 * se) };
+}
+
+static void write_estimate(std::ostream& out, const char *kind, const Estimate& e)
+{
+	out << kind << "\t" << e.value << "\t" << e.low << "\t" << e.high << "\t";
+}
+
+/*
+ * Report the fit, and write the table of estimates with their 95% confidence
+ * intervals if outfilename is given:
+ *
+ *   bias        value  low  high
+ *   exponent    value  low  high
+ *   probability p_enum low  high  trials  name   (one line per enum)
+ *
+ * Enums without any solve events are left out.
+ */
+static void save_fit(const Cells& cells, const Fit& fit, const char *outfilename)
+{
+	const auto bias = estimate(fit, log_bias_param, [] (double x) { return std::exp(x); });
+	const auto exponent = estimate(fit, exponent_param, [] (double x) { return x; });
+
+	cerr << endl;
+	cerr << "Fit " << (fit.converged ? "converged" : "did not converge") << " after " << fit.iterations << " iterations, log-likelihood " << fit.loglik << endl;
+	cerr << "odds(success) = odds(p_enum) * ((level + bias) / turn) ^ exponent, with 95% confidence intervals:" << endl;
+	cerr << setw(20) << "bias" << setw(12) << bias.value << "  [" << bias.low << ", " << bias.high << "]" << endl;
+	cerr << setw(20) << "exponent" << setw(12) << exponent.value << "  [" << exponent.low << ", " << exponent.high << "]" << endl;
+	for (size_t e = 0; e < enum_count; ++e) {
+		const auto& name = reverse_lookup_probability(Probability(e));
+		if (cells.enum_trials[e] == 0) {
+			cerr << setw(20) << name << "  (no solve events)" << endl;
+			continue;
+		}
+		const auto p = estimate(fit, e, sigmoid);
+		cerr << setw(20) << name << setw(12) << p.value << "  [" << p.low << ", " << p.high << "]  " << cells.enum_trials[e] << " events" << endl;
+	}
+
+	if (!outfilename) {
+		return;
+	}
+	cerr << endl;
+	cerr << "Writing risk table to " << outfilename << "..." << endl;
+	ofstream out(outfilename, std::ios::binary);
+	out << std::setprecision(9);
+	write_estimate(out, "bias", bias);
+	out << "\n";
+	write_estimate(out, "exponent", exponent);
+	out << "\n";
+	for (size_t e = 0; e < enum_count; ++e) {
+		if (cells.enum_trials[e] == 0) {
+			continue;
+		}
+		write_estimate(out, "probability", estimate(fit, e, sigmoid));
+		out << cells.enum_trials[e] << "\t" << reverse_lookup_probability(Probability(e)) << "\t\n";
+	}
+	if (!out) {
+		throw std::runtime_error("Failed to write risk table " + string(outfilename));
+	}
+}
+
+static void help()
+{
+	cerr << "Arguments:" << endl;
+	cerr << "  -i input-filename (text or binary event log, or shard directory)" << endl;
+	cerr << "  -o output-filename (risk table, for the players' -k option)" << endl;
+	cerr << "  -j thread-count (default: number of CPUs)" << endl;
+	cerr << "  -n max-iterations (default: " << fit_options.max_iterations << ")" << endl;
+	cerr << "  -l ridge (L2 penalty on each probability's log-odds, default: " << fit_options.ridge << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	init_locale();
+
+	const char *infilename = nullptr;
+	const char *outfilename = nullptr;
+	char c;
+	while ((c = getopt(argc, argv, "hi:o:j:n:l:")) != -1) {
+		switch (c) {
+		case 'h': help(); return 1;
+		case 'i': infilename = optarg; break;
+		case 'o': outfilename = optarg; break;
+		case 'j': thread_count = std::stoul(optarg); break;
+		case 'n': fit_options.max_iterations = std::stoul(optarg); break;
+		case 'l': fit_options.ridge = std::stod(optarg); break;
+		case '?': help(); return 1;
+		}
+	}
+
+	if (!infilename || thread_count == 0 || fit_options.ridge < 0 || optind != argc) {
+		help();
+		return 1;
+	}
+
+	const auto start = steady_clock::now();
+
+	cerr << "Reading file " << infilename << "..." << endl;
+	const LogReader log(infilename);
+	const auto cells = read_cells(log);
+	double trials = 0;
+	for (const auto n : cells.enum_trials) {
+		trials += n;
+	}
+	if (trials == 0) {
+		cerr << "No solve events in " << infilename << endl;
+		return 1;
+	}
+	cerr << trials << " solve events in " << cells.size() << " (enum, level, turn) cells" << endl;
+
+	const auto fit = fit_model(cells);
+	save_fit(cells, fit, outfilename);
+
+	cerr << "Done in " << std::chrono::duration<double>(steady_clock::now() - start).count() << "s" << endl;
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Builds (or brings up to date) the trajectory index of text event logs, see
+ * TrajectoryIndex.hpp, and fetches games' trajectories through it.
+ *
+ * For a shard directory, each shard gets an index of its own.
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "Locale.hpp"
+#include "BinaryLog.hpp"
+#include "LogFiles.hpp"
+#include "MappedFile.hpp"
+#include "TrajectoryIndex.hpp"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::cerr;
+using std::endl;
+using namespace mugloar;
+
+static void help()
+{
+	cerr << "Arguments:" << endl;
+	cerr << "  -i input-filename (text event log, or shard directory)" << endl;
+	cerr << "  -g game-id (print game's events in turn order, may be repeated)" << endl;
+	cerr << "  -s (print index statistics)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	init_locale();
+
+	const char *infilename = nullptr;
+	vector<string> games;
+	bool stats = false;
+	char c;
+	while ((c = getopt(argc, argv, "hi:g:s")) != -1) {
+		switch (c) {
+		case 'h': help(); return 1;
+		case 'i': infilename = optarg; break;
+		case 'g': games.push_back(optarg); break;
+		case 's': stats = true; break;
+		case '?': help(); return 1;
+		}
+	}
+
+	if (!infilename || optind != argc) {
+		help();
+		return 1;
+	}
+
+	try {
+		for (const auto& file : log_files(infilename)) {
+			if (is_binary_log(file)) {
+				cerr << "Skipping binary log " << file << endl;
+				continue;
+			}
+
+			/* Only scans what was appended since the last update */
+			IndexWriter writer(file);
+			const auto added = writer.update();
+			/* So that lookups don't have to scan records past the last directory */
+			writer.write_directory();
+			cerr << "Indexed " << added << " new events of " << file << endl;
+
+			if (!stats && games.empty()) {
+				continue;
+			}
+
+			const TrajectoryIndex index(file);
+			if (stats) {
+				cerr << file << ": " << index.games() << " games, " << index.events() << " events, longest game " << index.longest() << " turns" << endl;
+			}
+			if (!games.empty()) {
+				const MappedFile log(file);
+				for (const auto& game : games) {
+					for (const auto& line : index.trajectory(log, game)) {
+						cout << line << "\n";
+					}
+				}
+			}
+		}
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
@@ -2,36 +2,80 @@
  * Analyses event log from mugcollect/mugobasic/mugomatic, generating feature
  * cost table for machine-learning AI agent.
  */
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
 #include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include <getopt.h>
+#include <sys/resource.h>
 
 #include "Locale.hpp"
 #include "AnsiCodes.hpp"
+#include "ExtractFeatures.hpp"
+#include "LogReader.hpp"
+#include "Npy.hpp"
+#include "Parallel.hpp"
+#include "Pca.hpp"
+#include "TagDictionary.hpp"
 
 using std::string;
 using std::string_view;
 using std::vector;
 using std::unordered_map;
-using std::ifstream;
 using std::ofstream;
 using std::pair;
 using std::make_pair;
 using std::cerr;
 using std::endl;
-using std::getline;
+using std::chrono::steady_clock;
+using mugloar::LogReader;
+using mugloar::EventView;
+using mugloar::FieldValue;
+using mugloar::LogChunk;
+using mugloar::LogProgress;
+using mugloar::write_npy;
+using mugloar::SparseRows;
+using mugloar::Projection;
+using mugloar::principal_components;
+using mugloar::TagDictionary;
 
-/* Structure to hold training data */
+namespace fs = std::filesystem;
+
+/* Number of threads for parsing and learning */
+static unsigned thread_count = default_thread_count();
+
+/*
+ * Structure to hold training data
+ *
+ * Almost every tag is absent from almost every event, so the feature matrix is
+ * stored sparse, in compressed sparse row (CSR) layout: the non-zeros of row r
+ * are at [indptr[r], indptr[r + 1]) of indices (column) and values, sorted by
+ * column.  Memory scales with the number of non-zeros, not rows * tags.
+ *
+ * Tag names are views into the event log, which must outlive the dataset.
+ */
 struct Dataset
 {
 	/* Mapping of tag strings to column indices in feature matrix */
-	unordered_map<string, size_t> tags;
-	unordered_map<size_t, string> tags_r;
+	TagDictionary tags;
+	vector<string_view> tags_r;
 
 	/* Index of column associated with each feature */
 	size_t score_tag;
@@ -46,46 +90,62 @@ struct Dataset
 	size_t cols = 0;
 	size_t rows = 0;
 
-	/* Feature matrix */
-	vector<float> data;
+	/* Feature matrix (CSR) */
+	vector<std::int64_t> indptr;
+	vector<std::int32_t> indices;
+	vector<float> values;
 
-	size_t size() const
-	{
-		return data.size();
-	}
-
-	/* Accessors */
+	/* Number of events that each row stands for (from "meta:weight" of sampled logs, else 1) */
+	vector<float> weights;
 
-	auto row_begin(int row)
-	{
-		return data.begin() + (row * cols);
-	}
+	/* Game of each row (views into the event log) */
+	vector<string_view> games;
 
-	auto row_end(int row)
+	/* Number of non-zeros */
+	size_t size() const
 	{
-		return row_begin(row + 1);
+		return values.size();
 	}
 
-	float& operator () (int row, int col)
+	/* Value of a cell (0 if not stored) */
+	float operator () (size_t row, size_t col) const
 	{
-		return row_begin(row)[col];
+		const auto begin = indices.begin() + indptr[row];
+		const auto end = indices.begin() + indptr[row + 1];
+		const auto it = std::lower_bound(begin, end, std::int32_t(col));
+		return it != end && size_t(*it) == col ? values[it - indices.begin()] : 0.0f;
 	}
 
-	auto row_begin(int row) const
-	{
-		return data.begin() + (row * cols);
-	}
+};
 
-	auto row_end(int row) const
-	{
-		return row_begin(row + 1);
-	}
+/* Transposed (CSC) view of the feature matrix, for per-feature passes: the rows having column c are at [indptr[c], indptr[c + 1]) of rows, in order */
+struct ColumnView
+{
+	vector<std::int64_t> indptr;
+	vector<std::int32_t> rows;
+	vector<float> values;
 
-	const float& operator () (int row, int col) const
+	ColumnView(const Dataset& dataset)
 	{
-		return row_begin(row)[col];
+		/* Counting sort of the non-zeros by column, keeps rows in order within each column */
+		indptr.assign(dataset.cols + 1, 0);
+		for (const auto col : dataset.indices) {
+			++indptr[col + 1];
+		}
+		for (size_t col = 0; col < dataset.cols; ++col) {
+			indptr[col + 1] += indptr[col];
+		}
+		rows.resize(dataset.size());
+		values.resize(dataset.size());
+		vector<std::int64_t> next(indptr.begin(), indptr.end() - 1);
+		for (size_t row = 0; row < dataset.rows; ++row) {
+			for (auto i = dataset.indptr[row]; i < dataset.indptr[row + 1]; ++i) {
+				const auto pos = next[dataset.indices[i]]++;
+				rows[pos] = row;
+				values[pos] = dataset.values[i];
+			}
+		}
 	}
-
 };
 
 /* Asymmetric cost - differs for loss vs gain */
@@ -94,181 +154,1625 @@ static float asym(float x, float cost_neg, float cost_pos)
 	return x >= 0 ? x * cost_pos : x * cost_neg;
 }
 
+/* Changes caused by an action (the event's "diff:" fields), which the costfunction scores */
+struct Outcome
+{
+	float score = 0;
+	float lives = 0;
+	float gold = 0;
+	float rep_people = 0;
+	float rep_state = 0;
+	float rep_underworld = 0;
+	float level = 0;
+};
+
+/* Tag of each outcome field */
+static const pair<string_view, float Outcome::*> outcome_tags[] = {
+	{ "diff:score", &Outcome::score },
+	{ "diff:lives", &Outcome::lives },
+	{ "diff:gold", &Outcome::gold },
+	{ "diff:rep_people", &Outcome::rep_people },
+	{ "diff:rep_state", &Outcome::rep_state },
+	{ "diff:rep_underworld", &Outcome::rep_underworld },
+	{ "diff:level", &Outcome::level }
+};
+
 /*
- * Calculate cost of operation based on changes.
+ * Weights of the objectives in the costfunction.
  *
  * This controls how we prioritise different objectives (score, lives, etc).
  */
-static float costfunction(const Dataset& ds, const vector<float>::const_iterator& v)
+struct CostWeights
 {
-	float cost = 0;
-	/* Each life = moderate value (gain), high value (loss) */
-	cost += asym(v[ds.lives_tag], 150, 30);
+	/* Each life = high value (loss), moderate value (gain) */
+	float lives_loss = 150;
+	float lives_gain = 30;
 	/* Score = 0.1 per point */
-	cost += v[ds.score_tag] * 0.1f;
+	float score = 0.1f;
 	/* Reputation = 10 per loss, 20 per gain */
-	cost += asym(v[ds.rep_people_tag], 10, 20);
-	cost += asym(v[ds.rep_state_tag], 10, 20);
-	cost += asym(v[ds.rep_underworld_tag], 10, 20);
+	float rep_loss = 10;
+	float rep_gain = 20;
 	/* Level = 500 per level */
-	cost += v[ds.level_tag] * 500;
+	float level = 500;
+	/* Gold = not valued in itself, only for what it buys */
+	float gold = 0;
+};
+
+/* Calculate cost of operation based on changes */
+static float costfunction(const Outcome& o, const CostWeights& w = CostWeights())
+{
+	float cost = 0;
+	cost += asym(o.lives, w.lives_loss, w.lives_gain);
+	cost += o.score * w.score;
+	cost += asym(o.rep_people, w.rep_loss, w.rep_gain);
+	cost += asym(o.rep_state, w.rep_loss, w.rep_gain);
+	cost += asym(o.rep_underworld, w.rep_loss, w.rep_gain);
+	cost += o.level * w.level;
+	cost += o.gold * w.gold;
 
 	return cost;
 }
 
-/* Build the dataset from the string lists read from the input file */
-Dataset build_dataset(const vector<vector<string>>& data)
+/*
+ * The costfunction is linear in its weights: cost = sum of weight * term, for
+ * these terms of the outcome (in the order of CostWeights' members)
+ */
+static constexpr size_t cost_term_count = 7;
+
+static void cost_terms(const Outcome& o, float (&terms)[cost_term_count])
+{
+	terms[0] = std::min(o.lives, 0.0f);
+	terms[1] = std::max(o.lives, 0.0f);
+	terms[2] = o.score;
+	terms[3] = std::min(o.rep_people, 0.0f) + std::min(o.rep_state, 0.0f) + std::min(o.rep_underworld, 0.0f);
+	terms[4] = std::max(o.rep_people, 0.0f) + std::max(o.rep_state, 0.0f) + std::max(o.rep_underworld, 0.0f);
+	terms[5] = o.level;
+	terms[6] = o.gold;
+}
+
+static void weight_terms(const CostWeights& w, float (&terms)[cost_term_count])
+{
+	const float values[] = { w.lives_loss, w.lives_gain, w.score, w.rep_loss, w.rep_gain, w.level, w.gold };
+	std::copy(std::begin(values), std::end(values), terms);
+}
+
+/* Outcome of a row of the dataset */
+static Outcome outcome_of(const Dataset& ds, size_t row)
+{
+	Outcome o;
+	o.score = ds(row, ds.score_tag);
+	o.lives = ds(row, ds.lives_tag);
+	o.gold = ds(row, ds.gold_tag);
+	o.rep_people = ds(row, ds.rep_people_tag);
+	o.rep_state = ds(row, ds.rep_state_tag);
+	o.rep_underworld = ds(row, ds.rep_underworld_tag);
+	o.level = ds(row, ds.level_tag);
+	return o;
+}
+
+/* Column of a tag which the costfunction needs */
+static size_t required_tag(const Dataset& ds, const string_view& name)
+{
+	const auto col = ds.tags.find(name);
+	if (col == TagDictionary::none) {
+		throw std::runtime_error("Tag not found in event log: " + string(name));
+	}
+	return col;
+}
+
+/* Rows of one chunk of the log, in CSR layout */
+struct ChunkRows
+{
+	/* Tags of the chunk in order of first appearance (their index is the local id) */
+	vector<string_view> tags;
+
+	vector<std::int64_t> lengths;
+	/* Local ids, then columns once remapped */
+	vector<std::int32_t> indices;
+	vector<float> values;
+	vector<float> weights;
+	vector<string_view> games;
+};
+
+/*
+ * Build the dataset from the event log
+ *
+ * The log is parsed in newline-aligned chunks on all threads, in one pass.
+ * Each chunk numbers its tags locally (a small map, which stays in cache),
+ * builds its rows with those local ids, then adds its tags to the shared
+ * dictionary, which numbers them in order of first appearance in the log, so
+ * column numbers are the same as for a sequential pass.  Each chunk's local
+ * ids are then mapped to columns, and the chunks' rows joined in order.
+ */
+Dataset build_dataset(const LogReader& log)
 {
 	cerr << "Building dataset..." << endl;
 	Dataset out;
 
-	/* Helper function to iterate over the string grid */
-	auto foreach_line = [&] (auto callback) {
-		size_t row = 0;
-		for (const auto& line : data) {
-			/* Skip lines with invalid number of fields */
-			if (line.empty() || (line.size() & 1) == 0) {
-				cerr << "Invalid line #" << (row + 1) << " ignored" << endl;
-				continue;
-			}
-			for (auto it = line.begin() + 1, end = line.end(); it != end; it += 2) {
-				callback(row, it);
-			}
-			++row;
-		}
-	};
+	const string_view meta_prefix(mugloar::meta_prefix);
+	const string_view meta_weight(mugloar::meta_weight);
 
-	/* Assign each tag a unique number, used as column number to create the feature matrix */
-	out.tags.reserve(data.size() * 3);
-	out.tags.max_load_factor(10);
-	out.tags_r.reserve(data.size() * 3);
-	out.tags_r.max_load_factor(10);
-	foreach_line([&] (auto, auto col_it) {
-		auto [tag, is_new] = out.tags.try_emplace(*col_it, out.tags.size());
-		if (is_new) {
-			/* Add reverse mapping */
-			out.tags_r[tag->second] = tag->first;
+	const auto chunks = log.chunks(thread_count * 8);
+
+	/* Parse each chunk into rows, and add its tags to the dictionary */
+	cerr << "Parsing " << chunks.size() << " chunks on " << thread_count << " threads..." << endl;
+	vector<ChunkRows> chunk_rows(chunks.size());
+	parallel_for(chunks.size(), thread_count, [&] (size_t i) {
+		auto& res = chunk_rows[i];
+		unordered_map<string_view, std::int32_t> local;
+		log.for_each_event(chunks[i], [&] (const EventView& event) {
+			float weight = 1;
+			std::int64_t length = 0;
+			event.for_each_feature([&] (const string_view& tag, const FieldValue& value) {
+				/* Bookkeeping fields aren't features */
+				if (tag.substr(0, meta_prefix.size()) == meta_prefix) {
+					if (tag == meta_weight) {
+						weight = value;
+					}
+					return;
+				}
+				auto [it, is_new] = local.try_emplace(tag, res.tags.size());
+				if (is_new) {
+					res.tags.push_back(tag);
+				}
+				res.indices.push_back(it->second);
+				res.values.push_back(value);
+				++length;
+			});
+			res.lengths.push_back(length);
+			res.weights.push_back(weight);
+			res.games.push_back(event.game());
+		});
+		for (size_t j = 0; j < res.tags.size(); ++j) {
+			out.tags.insert(res.tags[j], (std::uint64_t(i) << 32) | j);
 		}
 	});
 
+	/* Assign each tag a unique number, used as column number to create the feature matrix */
+	out.tags_r = out.tags.assign_ids();
+	for (const auto& res : chunk_rows) {
+		out.rows += res.lengths.size();
+	}
+
 	/* Lookup and cache column numbers for specific features */
-	out.score_tag = out.tags["diff:score"];
-	out.lives_tag = out.tags["diff:lives"];
-	out.gold_tag = out.tags["diff:gold"];
-	out.rep_people_tag = out.tags["diff:rep_people"];
-	out.rep_state_tag = out.tags["diff:rep_state"];
-	out.rep_underworld_tag = out.tags["diff:rep_underworld"];
-	out.level_tag = out.tags["diff:level"];
+	out.score_tag = required_tag(out, "diff:score");
+	out.lives_tag = required_tag(out, "diff:lives");
+	out.gold_tag = required_tag(out, "diff:gold");
+	out.rep_people_tag = required_tag(out, "diff:rep_people");
+	out.rep_state_tag = required_tag(out, "diff:rep_state");
+	out.rep_underworld_tag = required_tag(out, "diff:rep_underworld");
+	out.level_tag = required_tag(out, "diff:level");
 
 	/* Set matrix geometry */
-	cerr << "Tags: " << out.tags.size() << endl;
-	cerr << "Rows: " << data.size() << endl;
-	cerr << "Size: " << (out.tags.size() * data.size() * 4 / 1048576) << " MB" << endl;
-	out.cols = out.tags.size();
-	out.rows = data.size();
-	out.data.resize(out.cols * out.rows);
-	std::fill(out.data.begin(), out.data.end(), 0.0f);
-
-	/* Build the feature matrix */
-	foreach_line([&] (auto row, auto col_it) {
-		/* Lookup tag's column and set value */
-		out(row, out.tags[*col_it]) = std::stof(col_it[1]);
+	cerr << "Tags: " << out.tags_r.size() << endl;
+	const string_view cross_prefix(mugloar::cross_feature_prefix);
+	cerr << "Cross-feature tags: " << std::count_if(out.tags_r.begin(), out.tags_r.end(), [&] (const auto& tag) {
+		return tag.substr(0, cross_prefix.size()) == cross_prefix;
+	}) << endl;
+	cerr << "Rows: " << out.rows << endl;
+	out.cols = out.tags_r.size();
+
+	/* Map each chunk's rows to columns: non-zeros only, sorted by column (the last value wins if a tag is repeated) */
+	parallel_for(chunks.size(), thread_count, [&] (size_t i) {
+		auto& res = chunk_rows[i];
+		vector<std::int32_t> column(res.tags.size());
+		for (size_t j = 0; j < res.tags.size(); ++j) {
+			column[j] = out.tags.find(res.tags[j]);
+		}
+		vector<pair<std::int32_t, float>> cells;
+		size_t in = 0;
+		size_t kept = 0;
+		for (auto& length : res.lengths) {
+			cells.clear();
+			for (auto j = in; j < in + length; ++j) {
+				cells.emplace_back(column[res.indices[j]], res.values[j]);
+			}
+			in += length;
+			std::stable_sort(cells.begin(), cells.end(), [] (const auto& a, const auto& b) { return a.first < b.first; });
+			length = 0;
+			for (size_t j = 0; j < cells.size(); ++j) {
+				if (j + 1 < cells.size() && cells[j + 1].first == cells[j].first) {
+					continue;
+				}
+				if (cells[j].second != 0) {
+					res.indices[kept] = cells[j].first;
+					res.values[kept] = cells[j].second;
+					++kept;
+					++length;
+				}
+			}
+		}
+		res.indices.resize(kept);
+		res.values.resize(kept);
 	});
+
+	/* Join the chunks' rows */
+	out.indptr.reserve(out.rows + 1);
+	out.indptr.push_back(0);
+	out.weights.reserve(out.rows);
+	out.games.reserve(out.rows);
+	size_t nnz = 0;
+	for (const auto& res : chunk_rows) {
+		nnz += res.values.size();
+	}
+	out.indices.reserve(nnz);
+	out.values.reserve(nnz);
+	for (auto& res : chunk_rows) {
+		for (const auto length : res.lengths) {
+			out.indptr.push_back(out.indptr.back() + length);
+		}
+		out.indices.insert(out.indices.end(), res.indices.begin(), res.indices.end());
+		out.values.insert(out.values.end(), res.values.begin(), res.values.end());
+		out.weights.insert(out.weights.end(), res.weights.begin(), res.weights.end());
+		out.games.insert(out.games.end(), res.games.begin(), res.games.end());
+		res = ChunkRows();
+	}
+	cerr << "Non-zeros: " << out.size() << " (" << (out.size() * (sizeof(float) + sizeof(std::int32_t)) / 1048576) << " MB, dense would be " << (out.cols * out.rows * sizeof(float) / 1048576) << " MB)" << endl;
+
+	/* Sampled logs: total weight is the number of events that were played */
+	double total_weight = 0;
+	for (const auto& w : out.weights) {
+		total_weight += w;
+	}
+	if (total_weight != out.rows) {
+		cerr << "Sampled rows stand for " << size_t(total_weight + 0.5) << " events" << endl;
+	}
 	return out;
 }
 
-/* Read the file line-by-line, splitting each column by tab-terminator */
-static vector<vector<string>> read_file(const string& in)
+static vector<float> calc_row_costs(const Dataset& dataset)
 {
-	cerr << "Reading file " << in << "..." << endl;
-	ifstream f(in);
-	vector<vector<string>> data;
-	data.reserve(100000);
+	cerr << "Calculating costs for each event..." << endl;
 
-	/* Read file line-by-line */
-	string line;
-	while (getline(f, line)) {
-		string_view sv(line);
-		string_view::size_type end;
-		/* Split line into fields by tab-terminator */
-		auto& fields = data.emplace_back();
-		fields.reserve(1000);
-		while ((end = sv.find('\t')) != string_view::npos) {
-			fields.push_back(string(sv.substr(0, end)));
-			sv.remove_prefix(end + 1);
-		}
-	}
-	return data;
+	vector<float> row_cost(dataset.rows);
+
+	/* Calculate cost of each row and store it, rows split into a block per thread */
+	parallel_for(thread_count, thread_count, [&] (size_t t) {
+		const auto end = dataset.rows * (t + 1) / thread_count;
+		for (auto row = dataset.rows * t / thread_count; row < end; ++row) {
+			row_cost[row] = costfunction(outcome_of(dataset, row));
+		}
+	});
+
+	return row_cost;
 }
 
-static vector<float> calc_row_costs(const Dataset& dataset)
+/* Settings of multi-step credit assignment */
+struct ReturnOptions
 {
-	cerr << "Calculating costs for each event..." << endl;
+	bool enabled = false;
+	/* Discount per turn */
+	double gamma = 1;
+	/* Number of turns summed (0 = to the end of the game) */
+	size_t horizon = 0;
+};
 
-	vector<float> row_cost;
+static ReturnOptions return_options;
 
-	row_cost.reserve(dataset.rows);
+/*
+ * Replace each row's cost by the discounted return from it: the sum of the
+ * costs of the following events of the game, up to the horizon, each
+ * discounted by gamma per turn:
+ *
+ *   G[t] = cost[t] + gamma * cost[t + 1] + ... + gamma^(horizon - 1) * cost[t + horizon - 1]
+ *
+ * So the actions leading up to e.g. a loss of life share the blame for it,
+ * and purchases get credit for what they make possible later.
+ *
+ * Rows are grouped by game (a counting sort, keeping log order) and ordered by
+ * "game:turn" within each game, then each trajectory is a single backward
+ * pass, using G[t] = cost[t] + gamma * G[t + 1] - gamma^horizon * cost[t + horizon].
+ */
+static vector<float> calc_returns(const Dataset& dataset, const vector<float>& row_cost)
+{
+	const auto& opt = return_options;
+	cerr << "Calculating discounted returns (gamma " << opt.gamma << ", horizon " << (opt.horizon ? std::to_string(opt.horizon) : string("end of game")) << ")..." << endl;
 
-	/* Calculate cost of each row and store it */
+	/* Number each game in order of first appearance */
+	unordered_map<string_view, std::uint32_t> game_ids;
+	vector<std::uint32_t> row_game(dataset.rows);
 	for (size_t row = 0; row < dataset.rows; ++row) {
-		row_cost.push_back(costfunction(dataset, dataset.row_begin(row)));
+		row_game[row] = game_ids.try_emplace(dataset.games[row], game_ids.size()).first->second;
 	}
+	const size_t game_count = game_ids.size();
 
-	return row_cost;
+	/* Rows of each game, in log order */
+	vector<size_t> start(game_count + 1, 0);
+	for (const auto g : row_game) {
+		++start[g + 1];
+	}
+	for (size_t g = 0; g < game_count; ++g) {
+		start[g + 1] += start[g];
+	}
+	vector<std::uint32_t> order(dataset.rows);
+	{
+		vector<size_t> next(start.begin(), start.end() - 1);
+		for (size_t row = 0; row < dataset.rows; ++row) {
+			order[next[row_game[row]]++] = row;
+		}
+	}
+
+	const auto turn_col = dataset.tags.find("game:turn");
+	if (turn_col == TagDictionary::none) {
+		cerr << "No game:turn tag, assuming events are in turn order" << endl;
+	}
+
+	vector<float> returns(dataset.rows);
+	const double gamma_h = opt.horizon ? std::pow(opt.gamma, opt.horizon) : 0.0;
+	/* Games split into a block per task */
+	const size_t tasks = thread_count * 8;
+	parallel_for(tasks, thread_count, [&] (size_t t) {
+		vector<float> turns;
+		const auto end = game_count * (t + 1) / tasks;
+		for (auto g = game_count * t / tasks; g < end; ++g) {
+			const auto begin = order.begin() + start[g];
+			const auto finish = order.begin() + start[g + 1];
+			if (turn_col != TagDictionary::none) {
+				turns.clear();
+				for (auto it = begin; it != finish; ++it) {
+					turns.push_back(dataset(*it, turn_col));
+				}
+				if (!std::is_sorted(turns.begin(), turns.end())) {
+					std::stable_sort(begin, finish, [&] (auto a, auto b) { return dataset(a, turn_col) < dataset(b, turn_col); });
+				}
+			}
+			const size_t n = finish - begin;
+			double ret = 0;
+			for (size_t i = n; i-- > 0; ) {
+				ret = row_cost[begin[i]] + opt.gamma * ret;
+				if (opt.horizon && i + opt.horizon < n) {
+					ret -= gamma_h * row_cost[begin[i + opt.horizon]];
+				}
+				returns[begin[i]] = ret;
+			}
+		}
+	});
+
+	cerr << "Trajectories: " << game_count << ", mean length " << (game_count ? double(dataset.rows) / game_count : 0.0) << endl;
+	return returns;
 }
 
-/* Calculate cost of each feature (assumes features are independent, which is false) */
+/*
+ * Normalise each feature cost by (weighted) number of samples, punishing ones
+ * which we have few samples for: we only weakly consider features that we
+ * haven't sampled much
+ *
+ * Totals must be accumulated in double: a float stops counting at 2^24, so
+ * the weights of a feature in more than 16.7M events would stop adding up.
+ */
+static float normalise_cost(double total_cost, double total_weight)
+{
+	return total_cost / (total_weight + 20);
+}
+
+/*
+ * Calculate cost of each feature (assumes features are independent, which is false)
+ *
+ * Rows are split into a block per thread, and each thread walks its rows in
+ * storage order, adding the row's cost to accumulators of its features.  The
+ * per-thread accumulators (structure of arrays, so each is a dense run of
+ * memory) are summed at the end, in thread order.
+ */
 static vector<pair<float, size_t>> calc_feature_costs(const Dataset& dataset, const vector<float>& row_cost)
 {
-	cerr << "Accumulating costs for each feature (no cross-correlation)" << endl;
+	cerr << "Accumulating costs for each feature (no cross-correlation) on " << thread_count << " threads" << endl;
+
+	struct Accumulators
+	{
+		vector<double> cost;
+		vector<double> weight;
+		vector<std::uint32_t> samples;
+	};
+	vector<Accumulators> acc(thread_count);
+
+	parallel_for(thread_count, thread_count, [&] (size_t t) {
+		auto& a = acc[t];
+		a.cost.assign(dataset.cols, 0);
+		a.weight.assign(dataset.cols, 0);
+		a.samples.assign(dataset.cols, 0);
+		double *cost = a.cost.data();
+		double *weight = a.weight.data();
+		std::uint32_t *samples = a.samples.data();
+		const std::int32_t *indices = dataset.indices.data();
+		const auto end = dataset.rows * (t + 1) / thread_count;
+		for (auto row = dataset.rows * t / thread_count; row < end; ++row) {
+			/* Each row weighted by the number of events it stands for */
+			const double w = dataset.weights[row];
+			const double c = row_cost[row] * w;
+			for (auto i = dataset.indptr[row]; i < dataset.indptr[row + 1]; ++i) {
+				const auto col = indices[i];
+				cost[col] += c;
+				weight[col] += w;
+				samples[col]++;
+			}
+		}
+	});
+
+	/* Sum the threads' accumulators, columns split into a block per thread */
+	vector<pair<float, size_t>> feature_cost(dataset.cols);
+	parallel_for(thread_count, thread_count, [&] (size_t t) {
+		const auto end = dataset.cols * (t + 1) / thread_count;
+		for (auto col = dataset.cols * t / thread_count; col < end; ++col) {
+			double total_cost = 0;
+			double total_weight = 0;
+			size_t samples = 0;
+			for (const auto& a : acc) {
+				total_cost += a.cost[col];
+				total_weight += a.weight[col];
+				samples += a.samples[col];
+			}
+			feature_cost[col] = { normalise_cost(total_cost, total_weight), samples };
+		}
+	});
+
+	return feature_cost;
+}
+
+/* Single-threaded reference implementation of calc_feature_costs, one column at a time over the transposed matrix (for benchmarking) */
+static vector<pair<float, size_t>> calc_feature_costs_by_column(const Dataset& dataset, const vector<float>& row_cost)
+{
+	const ColumnView columns(dataset);
 
 	vector<pair<float, size_t>> feature_cost;
 	feature_cost.reserve(dataset.cols);
 
-	/* Accumulate cost per-feature */
 	for (size_t col = 0; col < dataset.cols; ++col) {
-		auto& [total_cost, samples] = feature_cost.emplace_back(0.0f, size_t(0));
-		for (size_t row = 0; row < dataset.rows; ++row) {
-			const auto& cost = row_cost[row];
-			const auto& input = dataset(row, col);
-			if (input != 0) {
-				total_cost += cost;
-				samples++;
+		double total_cost = 0;
+		double total_weight = 0;
+		for (auto i = columns.indptr[col]; i < columns.indptr[col + 1]; ++i) {
+			const auto row = columns.rows[i];
+			const double weight = dataset.weights[row];
+			total_cost += row_cost[row] * weight;
+			total_weight += weight;
+		}
+		feature_cost.emplace_back(normalise_cost(total_cost, total_weight), columns.indptr[col + 1] - columns.indptr[col]);
+	}
+
+	return feature_cost;
+}
+
+/* Time both implementations of calc_feature_costs, and check that they agree */
+static void benchmark_feature_costs(const Dataset& dataset, const vector<float>& row_cost)
+{
+	const unsigned repeats = 5;
+
+	auto time = [&] (const char *name, auto func) {
+		vector<pair<float, size_t>> res;
+		const auto start = steady_clock::now();
+		for (unsigned i = 0; i < repeats; ++i) {
+			res = func(dataset, row_cost);
+		}
+		const std::chrono::duration<double, std::milli> elapsed = steady_clock::now() - start;
+		cerr << "Benchmark: " << name << ": " << elapsed.count() / repeats << " ms" << endl;
+		return res;
+	};
+
+	const auto by_column = time("by column, 1 thread", calc_feature_costs_by_column);
+	const auto by_row = time("by row", calc_feature_costs);
+
+	float max_diff = 0;
+	size_t sample_mismatches = 0;
+	for (size_t col = 0; col < dataset.cols; ++col) {
+		max_diff = std::max(max_diff, std::fabs(by_column[col].first - by_row[col].first));
+		sample_mismatches += by_column[col].second != by_row[col].second;
+	}
+	cerr << "Benchmark: max cost difference " << max_diff << ", sample count mismatches " << sample_mismatches << endl;
+}
+
+/*
+ * Read costfunction weights to sweep, a line of whitespace-separated numbers
+ * per costfunction, in the order of CostWeights' members (lines starting with
+ * "#" are comments)
+ */
+static vector<CostWeights> read_sweep(const string& filename)
+{
+	std::ifstream f(filename);
+	if (!f) {
+		throw std::runtime_error("Failed to open costfunction weights file " + filename);
+	}
+	vector<CostWeights> sweep;
+	string line;
+	for (size_t line_no = 1; std::getline(f, line); ++line_no) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::istringstream ss(line);
+		auto& w = sweep.emplace_back();
+		for (auto member : { &CostWeights::lives_loss, &CostWeights::lives_gain, &CostWeights::score, &CostWeights::rep_loss, &CostWeights::rep_gain, &CostWeights::level, &CostWeights::gold }) {
+			ss >> w.*member;
+		}
+		if (ss.fail()) {
+			throw std::runtime_error("Invalid costfunction weights at line " + std::to_string(line_no) + " of " + filename);
+		}
+	}
+	if (sweep.empty()) {
+		throw std::runtime_error("No costfunction weights in " + filename);
+	}
+	return sweep;
+}
+
+/*
+ * Feature costs for each of a sweep of costfunction weights, in one pass
+ *
+ * As the costfunction is linear in its weights (see cost_terms), and feature
+ * costs are linear in the row costs, each feature only needs the (weighted)
+ * sums of the outcome terms of its rows, rather than a cost sum per
+ * costfunction.  The sums are accumulated as in calc_feature_costs, as a
+ * cache line of 8 doubles per feature (7 terms + weight), then multiplied by
+ * the K x 7 weight matrix.  So the data pass costs about the same as for one
+ * costfunction, however many are swept.
+ */
+static vector<vector<pair<float, size_t>>> calc_feature_costs_sweep(const Dataset& dataset, const vector<CostWeights>& sweep)
+{
+	cerr << "Accumulating costs for each feature for " << sweep.size() << " costfunctions on " << thread_count << " threads" << endl;
+
+	constexpr size_t stride = 8;
+	static_assert(cost_term_count < stride);
+
+	struct Accumulators
+	{
+		/* Per feature: weighted sums of each term, then sum of weights */
+		vector<double> sums;
+		vector<std::uint32_t> samples;
+	};
+	vector<Accumulators> acc(thread_count);
+
+	parallel_for(thread_count, thread_count, [&] (size_t t) {
+		auto& a = acc[t];
+		a.sums.assign(dataset.cols * stride, 0);
+		a.samples.assign(dataset.cols, 0);
+		double *sums = a.sums.data();
+		std::uint32_t *samples = a.samples.data();
+		const std::int32_t *indices = dataset.indices.data();
+		const auto end = dataset.rows * (t + 1) / thread_count;
+		for (auto row = dataset.rows * t / thread_count; row < end; ++row) {
+			const double w = dataset.weights[row];
+			float terms[cost_term_count];
+			cost_terms(outcome_of(dataset, row), terms);
+			double row_sums[stride];
+			for (size_t j = 0; j < cost_term_count; ++j) {
+				row_sums[j] = terms[j] * w;
+			}
+			row_sums[cost_term_count] = w;
+			for (size_t j = cost_term_count + 1; j < stride; ++j) {
+				row_sums[j] = 0;
 			}
+			for (auto i = dataset.indptr[row]; i < dataset.indptr[row + 1]; ++i) {
+				const auto col = indices[i];
+				double *s = &sums[col * stride];
+				for (size_t j = 0; j < stride; ++j) {
+					s[j] += row_sums[j];
+				}
+				samples[col]++;
+			}
+		}
+	});
+
+	/* Sum the threads' accumulators into the first */
+	auto& total = acc[0];
+	for (size_t t = 1; t < acc.size(); ++t) {
+		for (size_t i = 0; i < total.sums.size(); ++i) {
+			total.sums[i] += acc[t].sums[i];
+		}
+		for (size_t col = 0; col < dataset.cols; ++col) {
+			total.samples[col] += acc[t].samples[col];
 		}
 	}
 
-	/*
-	 * Normalise each feature cost by number of samples, punishing ones
-	 * which we have few samples for
-	 */
-	for (auto& [value, samples] : feature_cost) {
-		/* We only weakly consider features that we haven't sampled much */
-		value /= (samples + 20);
+	/* Weight matrix times term sums, a costfunction per task */
+	vector<vector<pair<float, size_t>>> feature_costs(sweep.size());
+	parallel_for(sweep.size(), thread_count, [&] (size_t k) {
+		float weights[cost_term_count];
+		weight_terms(sweep[k], weights);
+		auto& feature_cost = feature_costs[k];
+		feature_cost.resize(dataset.cols);
+		for (size_t col = 0; col < dataset.cols; ++col) {
+			const double *s = &total.sums[col * stride];
+			double cost = 0;
+			for (size_t j = 0; j < cost_term_count; ++j) {
+				cost += weights[j] * s[j];
+			}
+			feature_cost[col] = { normalise_cost(cost, s[cost_term_count]), total.samples[col] };
+		}
+	});
+
+	return feature_costs;
+}
+
+/* "diff:" tags are the outcome which the costs are calculated from, so can't be inputs of a model which predicts them */
+static bool is_model_input(const string_view& tag)
+{
+	const string_view diff_prefix("diff:");
+	return tag.substr(0, diff_prefix.size()) != diff_prefix;
+}
+
+/* Settings of the regression learner */
+struct SgdOptions
+{
+	unsigned epochs = 10;
+	/* Base step size (AdaGrad scales it per feature) */
+	float rate = 0.1f;
+	/* L2 regularisation strength */
+	float l2 = 1e-4f;
+	/* Fraction of rows held out for measuring loss */
+	float holdout = 0.1f;
+};
+
+static SgdOptions sgd_options;
+
+/*
+ * Fit feature weights by linear regression of the rows' costs (which accounts
+ * for correlated features, unlike calc_feature_costs), with lock-free
+ * parallel SGD ("Hogwild"): all threads update the shared weights without
+ * locking, each over its own slice of the shuffled rows.  Rows are sparse, so
+ * concurrent updates rarely touch the same weights.
+ *
+ * Step sizes are per-feature (AdaGrad), as feature values range from 0/1
+ * flags to gold and score counts.  Outcome tags aren't inputs (their weight is
+ * 0).
+ *
+ * The result has the same form as calc_feature_costs' (weight, samples), so
+ * mugomatic uses it unchanged.
+ */
+static vector<pair<float, size_t>> calc_feature_weights_sgd(const Dataset& dataset, const vector<float>& row_cost)
+{
+	const auto& opt = sgd_options;
+	cerr << "Fitting feature weights by SGD on " << thread_count << " threads (" << opt.epochs << " epochs, rate " << opt.rate << ", L2 " << opt.l2 << ")" << endl;
+
+	vector<char> input(dataset.cols);
+	for (size_t col = 0; col < dataset.cols; ++col) {
+		input[col] = is_model_input(dataset.tags_r[col]);
 	}
 
+	/* Split rows into training and held-out sets, by hash of the row number */
+	vector<std::uint32_t> train;
+	vector<std::uint32_t> holdout;
+	for (size_t row = 0; row < dataset.rows; ++row) {
+		std::uint64_t h = row * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 31;
+		((h % 1000) < opt.holdout * 1000 ? holdout : train).push_back(row);
+	}
+	cerr << "Training rows: " << train.size() << ", held-out rows: " << holdout.size() << endl;
+
+	/* Shared model: weights, and sums of squared gradients (relaxed atomics, so updates may be lost but not torn) */
+	vector<std::atomic<float>> weights(dataset.cols);
+	vector<std::atomic<float>> grad2(dataset.cols);
+	for (size_t col = 0; col < dataset.cols; ++col) {
+		weights[col].store(0, std::memory_order_relaxed);
+		grad2[col].store(0, std::memory_order_relaxed);
+	}
+	std::atomic<float> bias { 0 };
+	std::atomic<float> bias_grad2 { 0 };
+
+	constexpr auto relaxed = std::memory_order_relaxed;
+
+	auto predict = [&] (size_t row) {
+		float pred = bias.load(relaxed);
+		for (auto i = dataset.indptr[row]; i < dataset.indptr[row + 1]; ++i) {
+			const auto col = dataset.indices[i];
+			if (input[col]) {
+				pred += dataset.values[i] * weights[col].load(relaxed);
+			}
+		}
+		return pred;
+	};
+
+	/* Weighted mean squared error over a set of rows */
+	auto loss = [&] (const vector<std::uint32_t>& rows) {
+		vector<double> sum(thread_count);
+		vector<double> weight(thread_count);
+		parallel_for(thread_count, thread_count, [&] (size_t t) {
+			const auto end = rows.size() * (t + 1) / thread_count;
+			for (auto j = rows.size() * t / thread_count; j < end; ++j) {
+				const auto row = rows[j];
+				const double err = predict(row) - row_cost[row];
+				sum[t] += dataset.weights[row] * err * err;
+				weight[t] += dataset.weights[row];
+			}
+		});
+		double s = 0;
+		double w = 0;
+		for (size_t t = 0; t < thread_count; ++t) {
+			s += sum[t];
+			w += weight[t];
+		}
+		return w > 0 ? s / w : 0.0;
+	};
+
+	auto step = [&] (std::atomic<float>& w, std::atomic<float>& g2, float grad) {
+		const float acc = g2.load(relaxed) + grad * grad;
+		g2.store(acc, relaxed);
+		w.store(w.load(relaxed) - opt.rate * grad / (std::sqrt(acc) + 1e-6f), relaxed);
+	};
+
+	std::mt19937 prng(1);
+	for (unsigned epoch = 1; epoch <= opt.epochs; ++epoch) {
+		std::shuffle(train.begin(), train.end(), prng);
+		parallel_for(thread_count, thread_count, [&] (size_t t) {
+			const auto end = train.size() * (t + 1) / thread_count;
+			for (auto j = train.size() * t / thread_count; j < end; ++j) {
+				const auto row = train[j];
+				/* Gradient of weighted squared error */
+				const float err = (predict(row) - row_cost[row]) * dataset.weights[row];
+				step(bias, bias_grad2, err);
+				for (auto i = dataset.indptr[row]; i < dataset.indptr[row + 1]; ++i) {
+					const auto col = dataset.indices[i];
+					if (input[col]) {
+						step(weights[col], grad2[col], err * dataset.values[i] + opt.l2 * weights[col].load(relaxed));
+					}
+				}
+			}
+		});
+		cerr << "Epoch " << epoch << ": training loss " << loss(train) << ", held-out loss " << loss(holdout) << endl;
+	}
+
+	/* Baseline: always predicting the mean cost */
+	double mean = 0;
+	for (const auto row : train) {
+		mean += row_cost[row];
+	}
+	mean /= std::max<size_t>(1, train.size());
+	double baseline = 0;
+	for (const auto row : holdout) {
+		baseline += dataset.weights[row] * (row_cost[row] - mean) * (row_cost[row] - mean);
+	}
+	double holdout_weight = 0;
+	for (const auto row : holdout) {
+		holdout_weight += dataset.weights[row];
+	}
+	cerr << "Held-out loss of predicting the mean: " << (holdout_weight > 0 ? baseline / holdout_weight : 0.0) << endl;
+
+	vector<pair<float, size_t>> feature_cost(dataset.cols);
+	for (size_t col = 0; col < dataset.cols; ++col) {
+		feature_cost[col].first = weights[col].load(relaxed);
+	}
+	for (const auto col : dataset.indices) {
+		feature_cost[col].second++;
+	}
 	return feature_cost;
 }
 
-static void save_result(const Dataset& dataset, const vector<pair<float, size_t>>& feature_cost, const string& filename)
+/* Settings of principal component analysis */
+struct PcaOptions
 {
-	cerr << "Saving result to file " << filename << endl;
+	size_t components = 16;
+	/* Most-common features analysed (the correlation matrix is features^2) */
+	size_t max_features = 1024;
+	/* Rarer features are left out */
+	size_t min_samples = 10;
+};
 
-	ofstream f(filename);
+static PcaOptions pca_options;
+
+/* Principal components, and the cost model fitted over them */
+struct ReducedModel
+{
+	Projection projection;
+	/* Cost = intercept + sum of costs[c] * component c */
+	double intercept = 0;
+	vector<double> costs;
+};
+
+/*
+ * Many features are strongly correlated (e.g. ROT13-encoded messages and
+ * "Help defend" ones with the turn number), so the average-cost model counts
+ * the same evidence many times over.  Instead, project the features onto their
+ * top principal components, which are uncorrelated, and fit the row costs by
+ * weighted least squares over those.
+ */
+static ReducedModel calc_reduced_model(const Dataset& dataset, const vector<float>& row_cost)
+{
+	const auto& opt = pca_options;
 
-	/* Saves tuples of (cost, samples, name) */
+	/* Most common input features */
+	vector<size_t> samples(dataset.cols);
+	for (const auto col : dataset.indices) {
+		samples[col]++;
+	}
+	vector<std::int32_t> columns;
 	for (size_t col = 0; col < dataset.cols; ++col) {
-		const auto& header = dataset.tags_r.at(col);
+		if (samples[col] >= opt.min_samples && is_model_input(dataset.tags_r[col])) {
+			columns.push_back(col);
+		}
+	}
+	if (columns.size() > opt.max_features) {
+		std::stable_sort(columns.begin(), columns.end(), [&] (auto a, auto b) { return samples[a] > samples[b]; });
+		columns.resize(opt.max_features);
+		std::sort(columns.begin(), columns.end());
+	}
+	if (columns.empty()) {
+		throw std::runtime_error("No features with at least " + std::to_string(opt.min_samples) + " samples");
+	}
+
+	cerr << "Principal component analysis of " << columns.size() << " features on " << thread_count << " threads..." << endl;
+	const SparseRows m { dataset.indptr.data(), dataset.indices.data(), dataset.values.data(), dataset.weights.data(), dataset.rows, dataset.cols };
+	const auto t0 = steady_clock::now();
+	ReducedModel model;
+	model.projection = principal_components(m, columns, opt.components, thread_count);
+	const auto& proj = model.projection;
+	const auto k = proj.components();
+	cerr << "Found " << k << " components in " << std::chrono::duration<double>(steady_clock::now() - t0).count() << "s, explaining " << std::accumulate(proj.eigenvalues.begin(), proj.eigenvalues.end(), 0.0) / columns.size() * 100 << "% of feature variance" << endl;
+
+	/* Component scores of every row */
+	vector<double> scores(dataset.rows * k);
+	parallel_for(thread_count, thread_count, [&] (size_t t) {
+		const auto end = dataset.rows * (t + 1) / thread_count;
+		for (auto row = dataset.rows * t / thread_count; row < end; ++row) {
+			proj.project(m, row, &scores[row * k]);
+		}
+	});
+
+	/* Normal equations of weighted least squares, with the intercept as an extra input of 1 */
+	const size_t n = k + 1;
+	vector<double> a(n * n, 0.0);
+	vector<double> b(n, 0.0);
+	double total_weight = 0;
+	double mean_cost = 0;
+	for (size_t row = 0; row < dataset.rows; ++row) {
+		const double w = dataset.weights[row];
+		const double *z = &scores[row * k];
+		for (size_t i = 0; i < n; ++i) {
+			const double zi = i < k ? z[i] : 1.0;
+			for (size_t j = 0; j < n; ++j) {
+				a[i * n + j] += w * zi * (j < k ? z[j] : 1.0);
+			}
+			b[i] += w * zi * row_cost[row];
+		}
+		total_weight += w;
+		mean_cost += w * row_cost[row];
+	}
+	mean_cost /= std::max(total_weight, 1e-300);
+	/* Small ridge, in case of (near-)zero components */
+	for (size_t i = 0; i < k; ++i) {
+		a[i * n + i] += 1e-9 * total_weight;
+	}
+
+	/* Gaussian elimination with partial pivoting */
+	for (size_t col = 0; col < n; ++col) {
+		size_t pivot = col;
+		for (size_t i = col + 1; i < n; ++i) {
+			if (std::abs(a[i * n + col]) > std::abs(a[pivot * n + col])) {
+				pivot = i;
+			}
+		}
+		if (std::abs(a[pivot * n + col]) < 1e-300) {
+			throw std::runtime_error("Singular system fitting costs of principal components");
+		}
+		for (size_t j = 0; j < n; ++j) {
+			std::swap(a[col * n + j], a[pivot * n + j]);
+		}
+		std::swap(b[col], b[pivot]);
+		for (size_t i = col + 1; i < n; ++i) {
+			const double f = a[i * n + col] / a[col * n + col];
+			for (size_t j = col; j < n; ++j) {
+				a[i * n + j] -= f * a[col * n + j];
+			}
+			b[i] -= f * b[col];
+		}
+	}
+	vector<double> beta(n);
+	for (size_t i = n; i-- > 0; ) {
+		double x = b[i];
+		for (size_t j = i + 1; j < n; ++j) {
+			x -= a[i * n + j] * beta[j];
+		}
+		beta[i] = x / a[i * n + i];
+	}
+	model.costs.assign(beta.begin(), beta.begin() + k);
+	model.intercept = beta[k];
+
+	/* Goodness of fit */
+	double residual = 0;
+	double variance = 0;
+	for (size_t row = 0; row < dataset.rows; ++row) {
+		const double *z = &scores[row * k];
+		double pred = model.intercept;
+		for (size_t c = 0; c < k; ++c) {
+			pred += model.costs[c] * z[c];
+		}
+		residual += dataset.weights[row] * (row_cost[row] - pred) * (row_cost[row] - pred);
+		variance += dataset.weights[row] * (row_cost[row] - mean_cost) * (row_cost[row] - mean_cost);
+	}
+	cerr << "Cost variance explained by components: " << (variance > 0 ? (1 - residual / variance) * 100 : 0.0) << "%" << endl;
+
+	return model;
+}
+
+/*
+ * Save a reduced model as lines of tab-terminated fields:
+ *
+ *   components  <k>  <intercept>
+ *   eigenvalues  <eigenvalue of each component>
+ *   costs  <cost of each component>
+ *   feature  <name>  <mean>  <scale>  <loading on each component>
+ *
+ * A feature's component scores are (value - mean) / scale * loadings.
+ */
+static void save_reduced_model(const vector<string_view>& tags_r, const ReducedModel& model, const string& filename)
+{
+	cerr << "Saving principal components to file " << filename << endl;
+
+	const auto& proj = model.projection;
+	const auto k = proj.components();
+
+	ofstream f(filename);
+	f.precision(9);
+	f << "components\t" << k << "\t" << model.intercept << "\t\n";
+	f << "eigenvalues\t";
+	for (const auto x : proj.eigenvalues) {
+		f << x << "\t";
+	}
+	f << "\ncosts\t";
+	for (const auto x : model.costs) {
+		f << x << "\t";
+	}
+	f << "\n";
+	for (size_t i = 0; i < proj.columns.size(); ++i) {
+		f << "feature\t" << tags_r[proj.columns[i]] << "\t" << proj.mean[i] << "\t" << proj.scale[i] << "\t";
+		for (size_t c = 0; c < k; ++c) {
+			f << proj.loadings[i * k + c] << "\t";
+		}
+		f << "\n";
+	}
+	f.close();
+	if (!f) {
+		throw std::runtime_error("Failed to write " + filename);
+	}
+}
+
+/* Accumulators of a feature, for streaming */
+struct FeatureAcc
+{
+	double cost = 0;
+	double weight = 0;
+	size_t samples = 0;
+	/* Event in which the feature was last seen, and its cell there */
+	size_t last_event = size_t(-1);
+	size_t cell = 0;
+};
+
+/* Accumulators for the features seen in one chunk of the log, in order of first appearance */
+struct ChunkCosts
+{
+	vector<string_view> tags;
+	unordered_map<string_view, size_t> index;
+	vector<FeatureAcc> acc;
+};
+
+/* Feature cost accumulators of the log so far, and how far it has been read */
+struct StreamState
+{
+	vector<string_view> tags_r;
+	unordered_map<string_view, size_t> tags;
+	vector<FeatureAcc> acc;
+	size_t rows = 0;
+	LogProgress progress;
+
+	/* Storage of the tag names loaded from a checkpoint (tags_r has views into it, so the state mustn't be moved) */
+	string names;
+};
+
+/*
+ * Streaming alternative to build_dataset + calc_row_costs + calc_feature_costs
+ *
+ * The cost of each event is calculated from its diff fields as it is read, and
+ * added to the accumulators of its features, so no feature matrix is built:
+ * memory is bounded by the vocabulary size (per chunk), and time by reading
+ * the log.  Chunks are processed in parallel and merged in chunk order, so
+ * tags come out in the same order as from the feature matrix.
+ *
+ * Only the part of the log after state.progress is read, and merged into the
+ * state's accumulators (so a checkpointed state can be brought up to date by
+ * reading just what has been appended since).
+ */
+static void learn_streaming(const LogReader& log, StreamState& state)
+{
+	cerr << "Accumulating costs for each feature while reading the log (no cross-correlation)" << endl;
+
+	const string_view meta_prefix(mugloar::meta_prefix);
+	const string_view meta_weight(mugloar::meta_weight);
+
+	auto end = log.end();
+	const auto chunks = log.chunks(thread_count * 8, state.progress);
+
+	cerr << "Parsing " << chunks.size() << " chunks on " << thread_count << " threads..." << endl;
+	vector<ChunkCosts> chunk_costs(chunks.size());
+	vector<size_t> chunk_rows(chunks.size());
+	parallel_for(chunks.size(), thread_count, [&] (size_t i) {
+		auto& res = chunk_costs[i];
+		size_t event_no = 0;
+		/* Features of current event and their values (the last value wins if a tag is repeated) */
+		vector<pair<size_t, float>> cells;
+		log.for_each_event(chunks[i], [&] (const EventView& event) {
+			Outcome outcome;
+			float weight = 1;
+			cells.clear();
+			event.for_each_feature([&] (const string_view& tag, const FieldValue& field) {
+				/* Bookkeeping fields aren't features */
+				if (tag.substr(0, meta_prefix.size()) == meta_prefix) {
+					if (tag == meta_weight) {
+						weight = field;
+					}
+					return;
+				}
+				const float value = field;
+				auto [it, is_new] = res.index.try_emplace(tag, res.tags.size());
+				if (is_new) {
+					res.tags.push_back(tag);
+					res.acc.emplace_back();
+				}
+				auto& acc = res.acc[it->second];
+				if (acc.last_event == event_no) {
+					cells[acc.cell].second = value;
+				} else {
+					acc.last_event = event_no;
+					acc.cell = cells.size();
+					cells.emplace_back(it->second, value);
+				}
+				if (tag[0] == 'd') {
+					for (const auto& [name, member] : outcome_tags) {
+						if (tag == name) {
+							outcome.*member = value;
+						}
+					}
+				}
+			});
+			const float cost = costfunction(outcome);
+			for (const auto& [feature, value] : cells) {
+				if (value != 0) {
+					auto& acc = res.acc[feature];
+					acc.cost += double(cost) * weight;
+					acc.weight += weight;
+					acc.samples++;
+				}
+			}
+			++event_no;
+		});
+		chunk_rows[i] = event_no;
+	});
+
+	/* Merge accumulators in chunk order */
+	size_t rows = 0;
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		auto& res = chunk_costs[i];
+		for (size_t j = 0; j < res.tags.size(); ++j) {
+			auto [it, is_new] = state.tags.try_emplace(res.tags[j], state.tags_r.size());
+			if (is_new) {
+				state.tags_r.push_back(res.tags[j]);
+				state.acc.emplace_back();
+			}
+			auto& dst = state.acc[it->second];
+			dst.cost += res.acc[j].cost;
+			dst.weight += res.acc[j].weight;
+			dst.samples += res.acc[j].samples;
+		}
+		rows += chunk_rows[i];
+		res = ChunkCosts();
+	}
+	state.rows += rows;
+	cerr << "New rows: " << rows << endl;
+
+	/* Every file of the old progress is part of end (see LogReader::chunks) */
+	state.progress = std::move(end);
+}
+
+/* Feature costs of accumulated state */
+static vector<pair<float, size_t>> streamed_costs(const StreamState& state)
+{
+	for (const auto& [name, member] : outcome_tags) {
+		if (!state.tags.count(name)) {
+			throw std::runtime_error("Tag not found in event log: " + string(name));
+		}
+	}
+	cerr << "Tags: " << state.tags_r.size() << endl;
+	cerr << "Rows: " << state.rows << endl;
+
+	vector<pair<float, size_t>> feature_cost;
+	feature_cost.reserve(state.acc.size());
+	for (const auto& a : state.acc) {
+		feature_cost.emplace_back(normalise_cost(a.cost, a.weight), a.samples);
+	}
+	return feature_cost;
+}
+
+/*
+ * Checkpoint of the streaming state, as lines of tab-terminated fields:
+ *
+ *   muglearn-checkpoint  1
+ *   rows  <events>
+ *   file  <text|binary>  <offset>  <fingerprint>  <name>
+ *   tag  <sum of cost * weight>  <sum of weight>  <samples>  <name>
+ *
+ * Accumulators are written with enough digits to read back exactly.  The
+ * costfunction is baked into the accumulators, so a checkpoint must be
+ * discarded when it changes.
+ */
+static const string_view checkpoint_magic("muglearn-checkpoint");
+
+static void load_checkpoint(const string& filename, StreamState& state)
+{
+	std::ifstream f(filename, std::ios::binary);
+	if (!f) {
+		cerr << "No checkpoint " << filename << ", reading the whole log" << endl;
+		return;
+	}
+	cerr << "Loading checkpoint " << filename << endl;
+	state.names.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+
+	bool valid = false;
+	vector<string_view> fields;
+	mugloar::for_each_line(state.names, [&] (const string_view& line) {
+		fields.clear();
+		mugloar::for_each_field(line, [&] (const string_view& field) { fields.push_back(field); });
+		if (fields.empty()) {
+			return;
+		}
+		const auto& kind = fields[0];
+		/* Fields are tab-terminated, which stops strtod/strtoull */
+		if (kind == checkpoint_magic && fields.size() == 2) {
+			valid = fields[1] == "1";
+		} else if (kind == "rows" && fields.size() == 2) {
+			state.rows = std::strtoull(fields[1].data(), nullptr, 10);
+		} else if (kind == "file" && fields.size() == 5) {
+			state.progress.files.push_back({ string(fields[4]), fields[1] == "binary", std::strtoull(fields[2].data(), nullptr, 10), std::strtoull(fields[3].data(), nullptr, 16) });
+		} else if (kind == "tag" && fields.size() == 5) {
+			state.tags.emplace(fields[4], state.tags_r.size());
+			state.tags_r.push_back(fields[4]);
+			auto& acc = state.acc.emplace_back();
+			acc.cost = std::strtod(fields[1].data(), nullptr);
+			acc.weight = std::strtod(fields[2].data(), nullptr);
+			acc.samples = std::strtoull(fields[3].data(), nullptr, 10);
+		} else {
+			valid = false;
+		}
+	});
+	if (!valid) {
+		throw std::runtime_error("Invalid checkpoint file: " + filename);
+	}
+	cerr << "Checkpoint has " << state.rows << " rows, " << state.tags_r.size() << " tags" << endl;
+}
+
+/* Written to a temporary file then renamed over the old one, so an interrupted run leaves the previous checkpoint intact */
+static void save_checkpoint(const StreamState& state, const string& filename)
+{
+	cerr << "Saving checkpoint to file " << filename << endl;
+
+	const auto tmpname = filename + ".tmp";
+	ofstream f(tmpname, std::ios::binary | std::ios_base::trunc);
+	f.precision(17);
+	f << checkpoint_magic << "\t1\t\n";
+	f << "rows\t" << state.rows << "\t\n";
+	for (const auto& file : state.progress.files) {
+		f << "file\t" << (file.binary ? "binary" : "text") << "\t" << file.offset << "\t" << std::hex << file.fingerprint << std::dec << "\t" << file.name << "\t\n";
+	}
+	for (size_t i = 0; i < state.tags_r.size(); ++i) {
+		const auto& acc = state.acc[i];
+		f << "tag\t" << acc.cost << "\t" << acc.weight << "\t" << acc.samples << "\t" << state.tags_r[i] << "\t\n";
+	}
+	f.close();
+	if (!f) {
+		throw std::runtime_error("Failed to write checkpoint " + tmpname);
+	}
+	fs::rename(tmpname, filename);
+}
+
+/* Peak resident set size of this process, in bytes */
+static size_t peak_rss()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	/* Linux reports kB */
+	return size_t(usage.ru_maxrss) * 1024;
+}
+
+/* Parse a size in bytes, with optional K/M/G/T suffix (default: M) */
+static size_t parse_size(const string& s)
+{
+	size_t end;
+	const double value = std::stod(s, &end);
+	const auto suffix = end < s.size() ? std::toupper(s[end]) : 'M';
+	const string units = "KMGT";
+	const auto unit = units.find(suffix);
+	if (unit == string::npos || value <= 0 || (end < s.size() && end + 1 != s.size() && s.substr(end + 1) != "B" && s.substr(end + 1) != "iB")) {
+		throw std::runtime_error("Invalid size: " + s);
+	}
+	return size_t(value * double(size_t(1) << (10 * (unit + 1))));
+}
+
+/* Most spill files open at once (partitions are made bigger than the budget allows rather than exceed it) */
+static constexpr size_t max_spill_files = 512;
+
+/* One feature of one event, spilled to disk (cost is already weighted) */
+struct SpillRecord
+{
+	std::int32_t col;
+	float weight;
+	double cost;
+};
+
+/*
+ * Out-of-core alternative to learn_streaming, for when the accumulators (or
+ * the log's pages) don't fit in memory, in roughly memory_budget bytes:
+ *
+ *  1. Find the tags, in log order, as build_dataset does.
+ *  2. Read the log in waves of a chunk per thread, sized so that a wave's
+ *     records fit in half the budget.  Each event's cost is calculated, and a
+ *     record per feature is appended to the spill file of the partition
+ *     holding that feature's column (column ranges are sized so that a
+ *     partition's accumulators fit in the other half of the budget).  Pages of
+ *     the log are released once their chunk is done.
+ *  3. Accumulate each partition in turn, reading its spill file sequentially.
+ *
+ * Records are spilled in chunk order, and partitions summed in file order, so
+ * the result doesn't depend on the thread count, and it matches streaming
+ * mode.  A bigger budget means fewer, bigger chunks and partitions, so fewer
+ * passes, but the same result.
+ *
+ * The budget doesn't bound the vocabulary: the tag dictionary and the cost
+ * table (a few dozen bytes per tag, plus the names in the log's pages) stay
+ * resident throughout, so this helps when the rows outgrow memory, not when
+ * the tags alone do.
+ */
+static pair<vector<string_view>, vector<pair<float, size_t>>> learn_out_of_core(const LogReader& log, size_t memory_budget, const string& spilldir)
+{
+	cerr << "Learning out-of-core within " << (memory_budget >> 20) << " MB, spilling to " << spilldir << endl;
+
+	const string_view meta_prefix(mugloar::meta_prefix);
+	const string_view meta_weight(mugloar::meta_weight);
+
+	/* Records are at most 16 bytes per 4 bytes ("t\t1\t") of log */
+	const size_t chunk_bytes = std::max<size_t>(memory_budget / 2 / thread_count / (sizeof(SpillRecord) / 4), 1 << 20);
+	const auto chunks = log.chunks(std::max<size_t>(1, log.text_size() / chunk_bytes));
+	auto release = [&] (const LogChunk& chunk) {
+		if (!chunk.binary) {
+			log.texts()[chunk.file].release(chunk.text);
+		}
+	};
+
+	/* 1. Tags, in log order */
+	cerr << "Finding tags in " << chunks.size() << " chunks on " << thread_count << " threads..." << endl;
+	vector<string_view> tags_r;
+	unordered_map<string_view, std::int32_t> tags;
+	for (size_t wave = 0; wave < chunks.size(); wave += thread_count) {
+		const auto wave_size = std::min<size_t>(thread_count, chunks.size() - wave);
+		vector<vector<string_view>> chunk_tags(wave_size);
+		parallel_for(wave_size, thread_count, [&] (size_t i) {
+			unordered_map<string_view, bool> seen;
+			log.for_each_event(chunks[wave + i], [&] (const EventView& event) {
+				event.for_each_feature([&] (const string_view& tag, const FieldValue&) {
+					if (tag.substr(0, meta_prefix.size()) != meta_prefix && seen.try_emplace(tag, true).second) {
+						chunk_tags[i].push_back(tag);
+					}
+				});
+			});
+			release(chunks[wave + i]);
+		});
+		for (const auto& chunk : chunk_tags) {
+			for (const auto& tag : chunk) {
+				if (tags.try_emplace(tag, tags_r.size()).second) {
+					tags_r.push_back(tag);
+				}
+			}
+		}
+	}
+	for (const auto& [name, member] : outcome_tags) {
+		if (!tags.count(name)) {
+			throw std::runtime_error("Tag not found in event log: " + string(name));
+		}
+	}
+	const size_t cols = tags_r.size();
+	cerr << "Tags: " << cols << endl;
+	const size_t dictionary_bytes = cols * (sizeof(decltype(tags)::value_type) + 2 * sizeof(void *) + sizeof(string_view) + sizeof(pair<float, size_t>));
+	if (dictionary_bytes > memory_budget / 2) {
+		cerr << "Warning: the tag dictionary and cost table take about " << (dictionary_bytes >> 10) << " KB on top of the budget" << endl;
+	}
+
+	/* Partitions of columns */
+	struct Accumulator
+	{
+		double cost;
+		double weight;
+		size_t samples;
+	};
+	size_t partition_cols = std::max<size_t>(1, memory_budget / 2 / sizeof(Accumulator));
+	if ((cols + partition_cols - 1) / partition_cols > max_spill_files) {
+		partition_cols = (cols + max_spill_files - 1) / max_spill_files;
+		cerr << "Warning: more than " << max_spill_files << " partitions needed, so each partition's accumulators will exceed the budget" << endl;
+	}
+	const size_t partitions = (cols + partition_cols - 1) / partition_cols;
+	auto partition_of = [&] (std::int32_t col) { return size_t(col) / partition_cols; };
+	auto spill_name = [&] (size_t p) { return spilldir + "/partition." + std::to_string(p); };
+	cerr << "Partitions: " << partitions << " of up to " << partition_cols << " features" << endl;
+
+	/* 2. Spill records */
+	fs::create_directories(spilldir);
+	vector<ofstream> spills;
+	for (size_t p = 0; p < partitions; ++p) {
+		spills.emplace_back(spill_name(p), std::ios::binary | std::ios_base::trunc);
+		if (!spills.back()) {
+			throw std::runtime_error("Failed to open spill file " + spill_name(p) + ": " + strerror(errno));
+		}
+	}
+	cerr << "Spilling records..." << endl;
+	size_t rows = 0;
+	size_t records = 0;
+	for (size_t wave = 0; wave < chunks.size(); wave += thread_count) {
+		const auto wave_size = std::min<size_t>(thread_count, chunks.size() - wave);
+		/* Records of each chunk of the wave, by partition */
+		vector<vector<vector<SpillRecord>>> chunk_records(wave_size, vector<vector<SpillRecord>>(partitions));
+		vector<size_t> chunk_rows(wave_size);
+		parallel_for(wave_size, thread_count, [&] (size_t i) {
+			auto& out = chunk_records[i];
+			/* Features of current event and their values (the last value wins if a tag is repeated) */
+			vector<pair<std::int32_t, float>> cells;
+			log.for_each_event(chunks[wave + i], [&] (const EventView& event) {
+				Outcome outcome;
+				float weight = 1;
+				cells.clear();
+				event.for_each_feature([&] (const string_view& tag, const FieldValue& field) {
+					if (tag.substr(0, meta_prefix.size()) == meta_prefix) {
+						if (tag == meta_weight) {
+							weight = field;
+						}
+						return;
+					}
+					const float value = field;
+					cells.emplace_back(tags.find(tag)->second, value);
+					if (tag[0] == 'd') {
+						for (const auto& [name, member] : outcome_tags) {
+							if (tag == name) {
+								outcome.*member = value;
+							}
+						}
+					}
+				});
+				const float cost = costfunction(outcome);
+				std::stable_sort(cells.begin(), cells.end(), [] (const auto& a, const auto& b) { return a.first < b.first; });
+				for (size_t j = 0; j < cells.size(); ++j) {
+					if ((j + 1 < cells.size() && cells[j + 1].first == cells[j].first) || cells[j].second == 0) {
+						continue;
+					}
+					out[partition_of(cells[j].first)].push_back({ cells[j].first, weight, double(cost) * weight });
+				}
+				++chunk_rows[i];
+			});
+			release(chunks[wave + i]);
+		});
+		for (size_t i = 0; i < wave_size; ++i) {
+			for (size_t p = 0; p < partitions; ++p) {
+				const auto& part = chunk_records[i][p];
+				spills[p].write(reinterpret_cast<const char *>(part.data()), part.size() * sizeof(SpillRecord));
+				records += part.size();
+			}
+			rows += chunk_rows[i];
+		}
+	}
+	for (size_t p = 0; p < partitions; ++p) {
+		spills[p].close();
+		if (!spills[p]) {
+			throw std::runtime_error("Failed to write spill file " + spill_name(p));
+		}
+	}
+	cerr << "Rows: " << rows << endl;
+	cerr << "Spilled: " << records << " records (" << (records * sizeof(SpillRecord) >> 20) << " MB)" << endl;
+
+	/* 3. Accumulate each partition */
+	vector<pair<float, size_t>> feature_cost(cols);
+	vector<SpillRecord> buffer(std::max<size_t>(1, std::min<size_t>(memory_budget / 4, 64 << 20) / sizeof(SpillRecord)));
+	for (size_t p = 0; p < partitions; ++p) {
+		const size_t begin = p * partition_cols;
+		const size_t end = std::min(cols, begin + partition_cols);
+		vector<Accumulator> acc(end - begin, Accumulator { 0, 0, 0 });
+		std::ifstream f(spill_name(p), std::ios::binary);
+		while (f) {
+			f.read(reinterpret_cast<char *>(buffer.data()), buffer.size() * sizeof(SpillRecord));
+			const size_t count = f.gcount() / sizeof(SpillRecord);
+			for (size_t i = 0; i < count; ++i) {
+				auto& a = acc[buffer[i].col - begin];
+				a.cost += buffer[i].cost;
+				a.weight += buffer[i].weight;
+				a.samples++;
+			}
+		}
+		for (size_t col = begin; col < end; ++col) {
+			const auto& a = acc[col - begin];
+			feature_cost[col] = { normalise_cost(a.cost, a.weight), a.samples };
+		}
+		fs::remove(spill_name(p));
+	}
+	fs::remove(spilldir);
+
+	cerr << "Peak RSS: " << (peak_rss() >> 20) << " MB" << endl;
+
+	return { std::move(tags_r), std::move(feature_cost) };
+}
+
+/* Pruning of the cost table (the defaults keep everything) */
+struct PruneOptions
+{
+	/* Features with fewer samples are dropped */
+	size_t min_samples = 0;
+	/* Features with a smaller absolute cost are dropped */
+	float min_abs_cost = 0;
+	/* Only this many features with the largest absolute costs are kept (0 = all) */
+	size_t top = 0;
+	/*
+	 * Add a default entry with cost 0 to a pruned table, for mugomatic.  It
+	 * costs every tag missing from the table at 0, so pruned tags aren't
+	 * penalised as unknown ones, but neither are tags never seen in training.
+	 */
+	bool default_entry = false;
+
+	bool enabled() const { return min_samples > 0 || min_abs_cost > 0 || top > 0; }
+};
+
+static PruneOptions prune_options;
+
+/* Name of the cost table entry for features which aren't in it (for mugomatic) */
+static const string_view default_cost_tag("*");
+
+/*
+ * Saves tuples of (cost, samples, name), sorted by name.
+ *
+ * Rare features get near-zero costs (see normalise_cost), and so contribute
+ * little to the player's decisions but a lot to the size of its cost table.
+ * The table can be pruned (see PruneOptions), optionally with a default
+ * entry for the pruned features.
+ */
+static void save_result(const vector<string_view>& tags_r, const vector<pair<float, size_t>>& feature_cost, const string& filename)
+{
+	const auto& opt = prune_options;
+
+	vector<std::uint32_t> kept;
+	kept.reserve(tags_r.size());
+	size_t rare = 0;
+	size_t small = 0;
+	for (size_t col = 0; col < tags_r.size(); ++col) {
 		const auto& [value, samples] = feature_cost[col];
-		f << value << "\t" << samples << "\t" << header << "\t" << endl;
+		if (samples < opt.min_samples) {
+			++rare;
+		} else if (std::abs(value) < opt.min_abs_cost) {
+			++small;
+		} else {
+			kept.push_back(col);
+		}
+	}
+	size_t beyond_top = 0;
+	if (opt.top > 0 && kept.size() > opt.top) {
+		std::nth_element(kept.begin(), kept.begin() + opt.top, kept.end(), [&] (auto a, auto b) {
+			const auto ca = std::abs(feature_cost[a].first);
+			const auto cb = std::abs(feature_cost[b].first);
+			return ca != cb ? ca > cb : tags_r[a] < tags_r[b];
+		});
+		beyond_top = kept.size() - opt.top;
+		kept.resize(opt.top);
+	}
+	std::sort(kept.begin(), kept.end(), [&] (auto a, auto b) { return tags_r[a] < tags_r[b]; });
+
+	/* Summary */
+	size_t total_samples = 0;
+	for (const auto& [value, samples] : feature_cost) {
+		total_samples += samples;
+	}
+	size_t kept_samples = 0;
+	double sum = 0;
+	vector<float> abs_costs;
+	abs_costs.reserve(kept.size());
+	for (const auto col : kept) {
+		kept_samples += feature_cost[col].second;
+		sum += feature_cost[col].first;
+		abs_costs.push_back(std::abs(feature_cost[col].first));
+	}
+	cerr << "Features: " << kept.size() << " of " << tags_r.size();
+	if (opt.enabled()) {
+		cerr << " (pruned " << rare << " with under " << opt.min_samples << " samples, " << small << " with |cost| under " << opt.min_abs_cost << ", " << beyond_top << " beyond the top " << opt.top << ")";
+	}
+	cerr << endl;
+	cerr << "Samples of kept features: " << (total_samples ? 100.0 * kept_samples / total_samples : 0.0) << "%" << endl;
+	if (!kept.empty()) {
+		auto [min, max] = std::minmax_element(kept.begin(), kept.end(), [&] (auto a, auto b) { return feature_cost[a].first < feature_cost[b].first; });
+		std::nth_element(abs_costs.begin(), abs_costs.begin() + abs_costs.size() / 2, abs_costs.end());
+		cerr << "Cost: min " << feature_cost[*min].first << " (" << tags_r[*min] << "), max " << feature_cost[*max].first << " (" << tags_r[*max] << "), mean " << sum / kept.size() << ", median |cost| " << abs_costs[abs_costs.size() / 2] << endl;
+	}
+
+	cerr << "Saving result to file " << filename << endl;
+
+	ofstream f(filename);
+	if (opt.default_entry && kept.size() < tags_r.size()) {
+		f << 0 << "\t" << 0 << "\t" << default_cost_tag << "\t\n";
+	}
+	for (const auto col : kept) {
+		const auto& [value, samples] = feature_cost[col];
+		f << value << "\t" << samples << "\t" << tags_r[col] << "\t\n";
+	}
+	f.close();
+	if (!f) {
+		throw std::runtime_error("Failed to write " + filename);
+	}
+}
+
+/* Save the cost table of each costfunction of a sweep as <dirname>/feature_score.<k>.dat, and the weights of each as weights.txt */
+static void save_sweep(const vector<string_view>& tags_r, const vector<CostWeights>& sweep, const vector<vector<pair<float, size_t>>>& feature_costs, const string& dirname)
+{
+	fs::create_directories(dirname);
+
+	ofstream f(dirname + "/weights.txt");
+	f << "# table\tlives_loss\tlives_gain\tscore\trep_loss\trep_gain\tlevel\tgold\n";
+	for (size_t k = 0; k < sweep.size(); ++k) {
+		float weights[cost_term_count];
+		weight_terms(sweep[k], weights);
+		f << "feature_score." << k << ".dat";
+		for (const auto w : weights) {
+			f << "\t" << w;
+		}
+		f << "\n";
+		save_result(tags_r, feature_costs[k], dirname + "/feature_score." + std::to_string(k) + ".dat");
+	}
+	f.close();
+	if (!f) {
+		throw std::runtime_error("Failed to write weights to " + dirname);
+	}
+}
+
+/*
+ * Export the feature matrix for external analysis, as CSR arrays in .npy
+ * format (load with scipy.sparse.csr_matrix((values, indices, indptr))):
+ *
+ *   indptr.npy      int64, rows + 1 offsets into indices/values
+ *   indices.npy     int32, column of each non-zero
+ *   values.npy      float32, value of each non-zero
+ *   weights.npy     float32, number of events each row stands for
+ *   costs.npy       float32, costfunction of each row
+ *   vocabulary.txt  tag of each column, one per line
+ */
+static void export_dataset(const Dataset& dataset, const vector<float>& row_cost, const string& dirname)
+{
+	cerr << "Exporting dataset to " << dirname << endl;
+
+	fs::create_directories(dirname);
+
+	/* Already in CSR layout */
+	write_npy(dirname + "/indptr.npy", dataset.indptr);
+	write_npy(dirname + "/indices.npy", dataset.indices);
+	write_npy(dirname + "/values.npy", dataset.values);
+	write_npy(dirname + "/weights.npy", dataset.weights);
+	write_npy(dirname + "/costs.npy", row_cost);
+
+	ofstream f(dirname + "/vocabulary.txt");
+	for (const auto& tag : dataset.tags_r) {
+		f << tag << "\n";
+	}
+	f.close();
+	if (!f) {
+		throw std::runtime_error("Failed to write vocabulary to " + dirname);
 	}
 }
 
 static void help()
 {
 	cerr << "Arguments:" << endl;
-	cerr << "  -i input-filename" << endl;
+	cerr << "  -i input-filename (text or binary event log, or shard directory)" << endl;
 	cerr << "  -o output-filename" << endl;
+	cerr << "  -W costfunction-weights-filename (sweep: a cost table per line of weights, output-filename is a directory)" << endl;
+	cerr << "  -e export-directory (write feature matrix as CSR .npy arrays and vocabulary)" << endl;
+	cerr << "  -s (streaming: accumulate feature costs while reading, without building the feature matrix)" << endl;
+	cerr << "  -c checkpoint-filename (streaming, incrementally: only read what was appended to the log since the checkpoint, then update it)" << endl;
+	cerr << "  -j thread-count (default: number of CPUs)" << endl;
+	cerr << "  -m model (average: mean cost of events having each feature, default; sgd: linear regression; pca: linear regression over principal components)" << endl;
+	cerr << "  -n epochs (sgd, default: " << sgd_options.epochs << ")" << endl;
+	cerr << "  -r learning-rate (sgd, default: " << sgd_options.rate << ")" << endl;
+	cerr << "  -l l2-regularisation (sgd, default: " << sgd_options.l2 << ")" << endl;
+	cerr << "  -v held-out-fraction (sgd, default: " << sgd_options.holdout << ")" << endl;
+	cerr << "  -k components (pca, default: " << pca_options.components << ")" << endl;
+	cerr << "  -f max-features (pca: most common features analysed, default: " << pca_options.max_features << ")" << endl;
+	cerr << "  -g gamma (learn discounted returns over each game's following turns rather than each event's own cost, default: 1)" << endl;
+	cerr << "  -H horizon (number of turns in returns, default: 0 = to the end of the game)" << endl;
+	cerr << "  -p min-samples (prune features with fewer samples from the output)" << endl;
+	cerr << "  -a min-abs-cost (prune features with a smaller absolute cost from the output)" << endl;
+	cerr << "  -t top-k (only output the k features with the largest absolute costs)" << endl;
+	cerr << "  -D (pruned output gets a default \"*\" entry of cost 0, which mugomatic uses for every tag missing from it, instead of its unknown-tag penalty)" << endl;
+	cerr << "  -M, --memory-budget size (out-of-core: learn within about this much memory plus the tag dictionary, spilling to output-filename.spill/, e.g. 512M or 4G)" << endl;
+	cerr << "  -B (benchmark feature cost accumulation against the single-threaded per-column loop)" << endl;
 }
 
 int main(int argc, char *argv[])
@@ -277,29 +1781,130 @@ int main(int argc, char *argv[])
 
 	const char *infilename = nullptr;
 	const char *outfilename = nullptr;
+	const char *exportdirname = nullptr;
+	const char *checkpointfilename = nullptr;
+	const char *sweepfilename = nullptr;
+	bool streaming = false;
+	bool benchmark = false;
+	string model = "average";
+	size_t memory_budget = 0;
+	const struct option long_options[] = {
+		{ "memory-budget", required_argument, nullptr, 'M' },
+		{ nullptr, 0, nullptr, 0 }
+	};
 	char c;
-	while ((c = getopt(argc, argv, "hi:o:")) != -1) {
+	while ((c = getopt_long(argc, argv, "hi:o:e:sc:W:j:Bm:n:r:l:v:k:f:g:H:M:p:a:t:D", long_options, nullptr)) != -1) {
 		switch (c) {
 		case 'h': help(); return 1;
 		case 'i': infilename = optarg; break;
 		case 'o': outfilename = optarg; break;
+		case 'e': exportdirname = optarg; break;
+		case 's': streaming = true; break;
+		case 'c': checkpointfilename = optarg; streaming = true; break;
+		case 'W': sweepfilename = optarg; break;
+		case 'p': prune_options.min_samples = std::stoul(optarg); break;
+		case 'a': prune_options.min_abs_cost = std::stof(optarg); break;
+		case 't': prune_options.top = std::stoul(optarg); break;
+		case 'D': prune_options.default_entry = true; break;
+		case 'M': memory_budget = parse_size(optarg); break;
+		case 'g': return_options.gamma = std::stod(optarg); return_options.enabled = true; break;
+		case 'H': return_options.horizon = std::stoul(optarg); return_options.enabled = true; break;
+		case 'B': benchmark = true; break;
+		case 'm': model = optarg; break;
+		case 'n': sgd_options.epochs = std::stoul(optarg); break;
+		case 'r': sgd_options.rate = std::stof(optarg); break;
+		case 'l': sgd_options.l2 = std::stof(optarg); break;
+		case 'v': sgd_options.holdout = std::stof(optarg); break;
+		case 'k': pca_options.components = std::max(1, std::stoi(optarg)); break;
+		case 'f': pca_options.max_features = std::max(1, std::stoi(optarg)); break;
+		case 'j': thread_count = std::max(1, std::stoi(optarg)); break;
 		case '?': help(); return 1;
 		}
 	}
 
-	if (!infilename || !outfilename || optind != argc) {
+	if (!infilename || (!outfilename && !exportdirname) || optind != argc) {
 		help();
 		return 1;
 	}
 
-	const auto cells = read_file(infilename);
+	if (model != "average" && model != "sgd" && model != "pca") {
+		cerr << "Unknown model: " << model << endl;
+		return 1;
+	}
 
-	const auto dataset = build_dataset(cells);
+	if (streaming && (exportdirname || !outfilename || model != "average")) {
+		cerr << "Streaming mode needs an output file, only learns the average model, and can't export the feature matrix" << endl;
+		return 1;
+	}
 
-	const auto row_cost = calc_row_costs(dataset);
+	if (sweepfilename && (streaming || model != "average" || !outfilename)) {
+		cerr << "Costfunction sweeps need an output directory, and only learn the average model from the feature matrix" << endl;
+		return 1;
+	}
 
-	const auto feature_cost = calc_feature_costs(dataset, row_cost);
+	if (return_options.enabled && (streaming || sweepfilename)) {
+		cerr << "Discounted returns need whole trajectories, so can't be learned in streaming mode, or swept" << endl;
+		return 1;
+	}
+
+	if (memory_budget && (streaming || sweepfilename || exportdirname || return_options.enabled || model != "average" || !outfilename)) {
+		cerr << "Out-of-core learning needs an output file, and only learns the average model from each event's own cost" << endl;
+		return 1;
+	}
+
+	const auto sweep = sweepfilename ? read_sweep(sweepfilename) : vector<CostWeights>();
+
+	const LogReader log(infilename);
+
+	if (memory_budget) {
+		const auto [tags_r, feature_cost] = learn_out_of_core(log, memory_budget, string(outfilename) + ".spill");
+
+		save_result(tags_r, feature_cost, outfilename);
+
+		return 0;
+	}
+
+	if (streaming) {
+		StreamState state;
+		if (checkpointfilename) {
+			load_checkpoint(checkpointfilename, state);
+		}
+
+		learn_streaming(log, state);
+
+		save_result(state.tags_r, streamed_costs(state), outfilename);
 
-	save_result(dataset, feature_cost, outfilename);
+		if (checkpointfilename) {
+			save_checkpoint(state, checkpointfilename);
+		}
+
+		return 0;
+	}
+
+	const auto dataset = build_dataset(log);
+
+	auto row_cost = calc_row_costs(dataset);
+
+	if (return_options.enabled) {
+		row_cost = calc_returns(dataset, row_cost);
+	}
+
+	if (exportdirname) {
+		export_dataset(dataset, row_cost, exportdirname);
+	}
+
+	if (benchmark) {
+		benchmark_feature_costs(dataset, row_cost);
+	}
+
+	if (outfilename && sweepfilename) {
+		save_sweep(dataset.tags_r, sweep, calc_feature_costs_sweep(dataset, sweep), outfilename);
+	} else if (outfilename && model == "pca") {
+		save_reduced_model(dataset.tags_r, calc_reduced_model(dataset, row_cost), outfilename);
+	} else if (outfilename) {
+		const auto feature_cost = model == "sgd" ? calc_feature_weights_sgd(dataset, row_cost) : calc_feature_costs(dataset, row_cost);
+
+		save_result(dataset.tags_r, feature_cost, outfilename);
+	}
 
 }
@@ -0,0 +1,295 @@
+/*
+ * Merges per-worker event-log shards (see EventLog in LogEvent.hpp) into a
+ * single event log, for muglearn and friends.
+ *
+ * Each shard is already in time order, so this is a k-way merge, either of
+ * individual events by timestamp, or of whole games (by the timestamp of their
+ * first event) so that each game's events end up together.
+ */
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+#include <getopt.h>
+
+#include "Locale.hpp"
+#include "BinaryLog.hpp"
+#include "LogFiles.hpp"
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::unique_ptr;
+using std::make_unique;
+using std::priority_queue;
+using std::pair;
+using std::greater;
+using std::ifstream;
+using std::ofstream;
+using std::cerr;
+using std::endl;
+using std::getline;
+using std::uint64_t;
+using namespace mugloar;
+
+/* Merged output log */
+struct Output
+{
+	ofstream f;
+	unique_ptr<BinaryLogWriter> binary;
+};
+
+/* Read cursor over one shard */
+class Shard
+{
+public:
+	virtual ~Shard() = default;
+
+	/* Advance to next event, returns false at end of shard */
+	virtual bool next() = 0;
+
+	virtual const string& game() const = 0;
+	virtual uint64_t time() const = 0;
+
+	/* Copy current event to output */
+	virtual void write(Output& out) const = 0;
+};
+
+class TextShard : public Shard
+{
+	ifstream f;
+	string line;
+	string _game;
+	uint64_t _time = 0;
+
+public:
+	TextShard(const string& filename) :
+		f(filename, std::ios::binary)
+	{
+	}
+
+	bool next() override
+	{
+		if (!getline(f, line)) {
+			return false;
+		}
+		string_view sv(line);
+		_game = string(sv.substr(0, sv.find('\t')));
+		/* Timestamp written by the sharded logger */
+		_time = 0;
+		const auto key = "\t" + string(meta_time) + "\t";
+		if (auto pos = sv.find(key); pos != string_view::npos) {
+			const auto begin = pos + key.size();
+			_time = std::stoull(string(sv.substr(begin, sv.find('\t', begin) - begin)));
+		}
+		return true;
+	}
+
+	const string& game() const override { return _game; }
+	uint64_t time() const override { return _time; }
+
+	void write(Output& out) const override
+	{
+		out.f << line << "\n";
+	}
+};
+
+class BinaryShard : public Shard
+{
+	ifstream f;
+	BinaryLogReader reader;
+	EventBlock block;
+	size_t index = 0;
+
+public:
+	BinaryShard(const string& filename) :
+		f(filename, std::ios::binary),
+		reader(f)
+	{
+	}
+
+	bool next() override
+	{
+		if (++index < block.size()) {
+			return true;
+		}
+		index = 0;
+		while (reader.next(block)) {
+			if (block.size() > 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	const string& game() const override { return reader.game_names()[block.game[index]]; }
+	uint64_t time() const override { return block.time[index]; }
+
+	void write(Output& out) const override
+	{
+		const auto& names = reader.feature_names();
+		FeatureList features;
+		features.reserve(block.offsets[index + 1] - block.offsets[index]);
+		for (auto j = block.offsets[index]; j < block.offsets[index + 1]; ++j) {
+			features.emplace_back(names[block.features[j]], block.values[j]);
+		}
+		out.binary->write(game(), time(), features);
+	}
+};
+
+/*
+ * Advance shard to its next event, counting events which are earlier than the
+ * one before them in the shard (which would break the merge's ordering, and
+ * mean the shard is corrupt or wasn't written by the sharded logger)
+ */
+static bool advance(Shard& shard, size_t& out_of_order)
+{
+	const auto time = shard.time();
+	if (!shard.next()) {
+		return false;
+	}
+	if (shard.time() < time) {
+		++out_of_order;
+	}
+	return true;
+}
+
+/* (time, shard index) of each shard's current event or game, earliest first */
+using Heap = priority_queue<pair<uint64_t, size_t>, vector<pair<uint64_t, size_t>>, greater<>>;
+
+/* Merge events by timestamp */
+static size_t merge_by_time(vector<unique_ptr<Shard>>& shards, Output& out, size_t& out_of_order)
+{
+	Heap heap;
+	for (size_t i = 0; i < shards.size(); ++i) {
+		if (shards[i]->next()) {
+			heap.emplace(shards[i]->time(), i);
+		}
+	}
+
+	size_t events = 0;
+	while (!heap.empty()) {
+		const auto i = heap.top().second;
+		heap.pop();
+		auto& shard = *shards[i];
+		shard.write(out);
+		++events;
+		if (advance(shard, out_of_order)) {
+			heap.emplace(shard.time(), i);
+		}
+	}
+	return events;
+}
+
+/*
+ * Merge whole games, ordered by the time of their first event.
+ *
+ * A worker plays one game at a time, so each game is a contiguous run of
+ * events within its shard.
+ */
+static size_t merge_by_game(vector<unique_ptr<Shard>>& shards, Output& out, size_t& out_of_order)
+{
+	Heap heap;
+	for (size_t i = 0; i < shards.size(); ++i) {
+		if (shards[i]->next()) {
+			heap.emplace(shards[i]->time(), i);
+		}
+	}
+
+	size_t events = 0;
+	while (!heap.empty()) {
+		const auto i = heap.top().second;
+		heap.pop();
+		auto& shard = *shards[i];
+		const auto game = shard.game();
+		bool more;
+		do {
+			shard.write(out);
+			++events;
+		} while ((more = advance(shard, out_of_order)) && shard.game() == game);
+		if (more) {
+			heap.emplace(shard.time(), i);
+		}
+	}
+	return events;
+}
+
+static void help()
+{
+	cerr << "Arguments:" << endl;
+	cerr << "  -i input (shard directory or shard file, may be repeated)" << endl;
+	cerr << "  -o output-filename" << endl;
+	cerr << "  -k merge-key (time|game, default: time)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	init_locale();
+
+	vector<string> inputs;
+	const char *outfilename = nullptr;
+	string key = "time";
+	char c;
+	while ((c = getopt(argc, argv, "hi:o:k:")) != -1) {
+		switch (c) {
+		case 'h': help(); return 1;
+		case 'i': inputs.push_back(optarg); break;
+		case 'o': outfilename = optarg; break;
+		case 'k': key = optarg; break;
+		case '?': help(); return 1;
+		}
+	}
+
+	if (inputs.empty() || !outfilename || (key != "time" && key != "game") || optind != argc) {
+		help();
+		return 1;
+	}
+
+	/* Open shards, which must all be in the same format */
+	vector<string> files;
+	for (const auto& input : inputs) {
+		for (auto& file : log_files(input)) {
+			files.push_back(std::move(file));
+		}
+	}
+	if (files.empty()) {
+		cerr << "No shards found" << endl;
+		return 1;
+	}
+	const bool binary = is_binary_log(files[0]);
+	vector<unique_ptr<Shard>> shards;
+	for (const auto& file : files) {
+		if (is_binary_log(file) != binary) {
+			cerr << "Shard " << file << " is not in the same format as " << files[0] << endl;
+			return 1;
+		}
+		if (binary) {
+			shards.push_back(make_unique<BinaryShard>(file));
+		} else {
+			shards.push_back(make_unique<TextShard>(file));
+		}
+	}
+
+	cerr << "Merging " << shards.size() << " " << (binary ? "binary" : "text") << " shards by " << key << " into " << outfilename << "..." << endl;
+
+	Output out;
+	out.f = ofstream(outfilename, std::ios::binary | std::ios_base::trunc);
+	if (binary) {
+		out.binary = make_unique<BinaryLogWriter>(out.f);
+	}
+
+	size_t out_of_order = 0;
+	const auto events = key == "game" ? merge_by_game(shards, out, out_of_order) : merge_by_time(shards, out, out_of_order);
+
+	out.binary.reset();
+	cerr << "Events: " << events << endl;
+	if (out_of_order) {
+		cerr << "Warning: " << out_of_order << " events were earlier than the event before them in their shard, so the output isn't in time order" << endl;
+		return 1;
+	}
+}
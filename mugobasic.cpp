@@ -8,6 +8,7 @@
 #include <mutex>
 #include <deque>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -23,6 +24,7 @@
 #include "Game.hpp"
 #include "ExtractFeatures.hpp"
 #include "LogEvent.hpp"
+#include "ScoreLog.hpp"
 #include "AnsiCodes.hpp"
 #include "Parallel.hpp"
 #include "BasicAssist.hpp"
@@ -47,6 +49,7 @@ using std::mutex;
 using std::scoped_lock;
 using std::queue;
 using std::optional;
+using std::chrono::steady_clock;
 using namespace mugloar;
 
 using Int = long long;
@@ -56,7 +59,7 @@ static mutex io_mutex;
 
 /* Output files */
 static ofstream scores;
-static ofstream events;
+static std::unique_ptr<EventLog> events;
 
 static mutex score_mutex;
 static pair<Int, string> best_score { 0, "(none)" };
@@ -69,12 +72,16 @@ queue<const char *> hijack;
 /* API binding */
 static const mugloar::Api api;
 
+/* Maximum number of hashed state x action cross features per event (0 = off) */
+static size_t max_crosses = 0;
+
 static ofstream scoreboard_file;
 static ostream *scoreboard_display;
 
 static void play_move(mugloar::Game& game, ostream& ss)
 {
 	unordered_map<string, float> features;
+	FeatureCache::Value chosen_features;
 
 	auto pre = GameState(game);
 
@@ -82,13 +89,13 @@ static void play_move(mugloar::Game& game, ostream& ss)
 		/* If "buy item" action available, do it */
 		const auto& item = *items[0];
 		ss << "Buying item " << Emph(Cyan(item.name)) << " for " << Yellow(Int(item.cost)) << " gold" << endl;
-		extract_action_features(features, item);
+		chosen_features = action_features(item);
 		game.purchase_item(item);
 	} else if (auto msgs = sort_messages(game); !msgs.empty()) {
 		/* Else, if "solve message" action available, do it */
 		const auto& msg = *msgs[0];
 		ss << "Solving message " << Emph(Cyan(msg.message)) << " for " << Yellow(Int(msg.reward)) << " gold " << " with difficulty " << Magenta(msg.probability) << endl;
-		extract_action_features(features, msg);
+		chosen_features = action_features(msg);
 		game.solve_message(msg);
 	} else {
 		/* Else, burn a turn */
@@ -102,8 +109,17 @@ static void play_move(mugloar::Game& game, ostream& ss)
 	extract_game_state(features, pre);
 	extract_game_diff_state(features, diff);
 
+	/* Action features, and their crosses with pre-action state */
+	CrossFeatures cross;
+	if (chosen_features) {
+		for (const auto& [feature, value] : *chosen_features) {
+			features[feature] = value;
+		}
+		extract_cross_features(cross, CrossState(pre), *chosen_features, max_crosses);
+	}
+
 	/* Log features and changes */
-	log_event(events, game, features);
+	log_event(*events, game, features, cross);
 
 	++total_turns;
 }
@@ -121,6 +137,8 @@ static void print_scores()
 	ss << endl;
 	ss << Strong("Total turns: ") << total_turns << endl;
 	ss << endl;
+	action_feature_cache().print_stats(ss);
+	ss << endl << endl;
 }
 
 static ostream& print_game(const mugloar::Game& game, ostream& ss)
@@ -224,17 +242,17 @@ static void worker_task()
 			}
 		}
 
+		const auto started = steady_clock::now();
 		try {
 			play_game(game);
 		} catch (const std::runtime_error& e) {
 			cerr << "Worker #" << worker_id << ": error: " << e.what() << endl;
 		}
+		const std::chrono::duration<double> wall_time = steady_clock::now() - started;
 
 		/* Log game result */
 		{
-			stringstream ss;
-			ss << "id=" << game.id() << "\tscore=" << Int(game.score()) << "\tturns=" << Int(game.turn()) << "\tlevel=" << Int(game.level()) << "\tlives=" << Int(game.lives()) << "\t" << endl << flush;
-			auto str = ss.str();
+			const auto str = format_score(ScoreRecord(game, wall_time.count()));
 
 			scoped_lock lock(io_mutex);
 			cerr << str;
@@ -248,9 +266,16 @@ static void help()
 {
 	cerr << "Arguments:" << endl;
 	cerr << "  -o output-filename" << endl;
+	cerr << "  -b (write binary event log)" << endl;
+	cerr << "  -w (write a shard per worker, output-filename is a directory)" << endl;
+	cerr << "  -d event-log-durability (write|sync, default: write)" << endl;
+	cerr << "  -I (keep a trajectory index of the text event log, see mugindex)" << endl;
+	cerr << "  -R sample-size (only keep a sample of this many events per action/probability/turn stratum)" << endl;
 	cerr << "  -s score-filename" << endl;
 	cerr << "  -p worker-count" << endl;
 	cerr << "  -S scoreboard-filename" << endl;
+	cerr << "  -x max-cross-features (default: 0, disabled)" << endl;
+	cerr << "  -k risk-table-filename (success probabilities fitted by mugfit, default: built-in)" << endl;
 	cerr << "  [-g game-id]..." << endl;
 	cerr << endl;
 	cerr << "Send SIGHUP or SIGQUIT (^\\) to print the scoreboard" << endl;
@@ -262,19 +287,28 @@ int main(int argc, char *argv[])
 	init_locale();
 
 	const char *outfilename = nullptr;
+	EventLog::Options log_options;
 	const char *scorefilename = nullptr;
 	const char *scoreboardfilename = nullptr;
 	int worker_count = 20;
+	const char *riskfilename = nullptr;
 
 	char c;
-	while ((c = getopt(argc, argv, "ho:s:p:S:g:")) != -1) {
+	while ((c = getopt(argc, argv, "ho:s:p:S:g:x:bwd:IR:k:")) != -1) {
 		switch (c) {
 		case 'h': help(); return 1;
 		case 'o': outfilename = optarg; break;
+		case 'b': log_options.binary = true; break;
+		case 'w': log_options.sharded = true; break;
+		case 'd': log_options.durability = parse_durability(optarg); break;
+		case 'I': log_options.index = true; break;
+		case 'R': log_options.sample_size = std::stoul(optarg); break;
 		case 's': scorefilename = optarg; break;
 		case 'S': scoreboardfilename = optarg; break;
 		case 'p': worker_count = std::stoi(optarg); break;
 		case 'g': hijack.push(optarg); break;
+		case 'x': max_crosses = std::stoul(optarg); break;
+		case 'k': riskfilename = optarg; break;
 		case '?': help(); return 1;
 		}
 	}
@@ -284,9 +318,13 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (riskfilename) {
+		mugloar::load_probability_risk(riskfilename);
+	}
+
 	/* Open output files */
 
-	events = ofstream(outfilename, std::ios::binary | std::ios_base::app);
+	events = std::make_unique<EventLog>(outfilename, log_options);
 	scores = ofstream(scorefilename, std::ios::binary | std::ios_base::app);
 
 	/* Scoreboard file: default to STDERR if no file specified */
@@ -6,6 +6,7 @@
 #include <atomic>
 #include <mutex>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <fstream>
@@ -13,6 +14,8 @@
 #include <vector>
 #include <unordered_map>
 #include <functional>
+#include <algorithm>
+#include <cstdlib>
 
 #include <getopt.h>
 
@@ -20,12 +23,13 @@
 #include "Game.hpp"
 #include "ExtractFeatures.hpp"
 #include "LogEvent.hpp"
+#include "ScoreLog.hpp"
 #include "AnsiCodes.hpp"
 #include "Parallel.hpp"
+#include "MappedFile.hpp"
 
 using std::string;
 using std::string_view;
-using std::ifstream;
 using std::ofstream;
 using std::ostream;
 using std::stringstream;
@@ -41,74 +45,243 @@ using std::flush;
 using std::atomic;
 using std::mutex;
 using std::scoped_lock;
+using std::chrono::steady_clock;
 using namespace mugloar;
 
-using Costs = unordered_map<string, float>;
+/* Cost table */
+struct Costs
+{
+	/* Named features */
+	unordered_map<string, float> named;
+
+	/* Hashed state x action cross features, indexed by bucket (empty unless crosses are enabled) */
+	vector<float> cross;
+
+	/* Cost of a feature which isn't in the table */
+	float unknown = -5;
+
+	/* Are features missing from the table reported in the move log? */
+	bool warn_unknown = true;
+};
 
 /* For synchronising IO to files and STDERR */
 static mutex io_mutex;
 
 /* Output files */
-static ofstream events;
+static std::unique_ptr<EventLog> events;
 static ofstream scores;
 
 /* API binding */
 static const Api api;
 
-/* Read file cells */
-static vector<vector<string>> read_file(const string& in)
+/* Maximum number of hashed state x action cross features per action (0 = off) */
+static size_t max_crosses = 0;
+
+/* Empty cost table, with a cross table if they are enabled (2^cross_feature_bits floats) */
+static Costs new_costs()
 {
-	cerr << "Reading file " << in << "..." << endl;
+	Costs costs;
+	costs.named.reserve(100000);
+	if (max_crosses > 0) {
+		costs.cross.resize(size_t(1) << cross_feature_bits, 0.0f);
+	}
+	return costs;
+}
 
-	ifstream f(in);
-	vector<vector<string>> data;
-	data.reserve(100000);
-	/* Read file line-by-line */
-	string line;
-	while (getline(f, line)) {
-		string_view sv(line);
-		string_view::size_type end;
-		/* Split line into fields by tab-terminator */
-		auto& fields = data.emplace_back();
-		fields.reserve(5);
-		while ((end = sv.find('\t')) != string_view::npos) {
-			fields.push_back(string(sv.substr(0, end)));
-			sv.remove_prefix(end + 1);
+/* Set the cost of a named or hashed cross feature, returns false for a cross feature when they are disabled */
+static bool set_cost(Costs& costs, const string_view& name, float cost)
+{
+	const string_view prefix(cross_feature_prefix);
+	if (name.substr(0, prefix.size()) == prefix) {
+		if (costs.cross.empty()) {
+			return false;
 		}
+		costs.cross[std::strtoul(name.data() + prefix.size(), nullptr, 16) % costs.cross.size()] = cost;
+	} else {
+		costs.named[string(name)] = cost;
+	}
+	return true;
+}
+
+static void warn_unused_crosses(const string& in, size_t unused)
+{
+	if (unused > 0) {
+		cerr << "Ignoring costs of " << unused << " cross features in " << in << ", which are only used with -x" << endl;
 	}
-	return data;
 }
 
-/* Read costs for state and for action features */
-static unordered_map<string, float> read_costs(const vector<vector<string>>& data)
+/* Read costs for state and for action features, from lines of (cost, samples, name) ("*" = cost of features not in the table) */
+static Costs read_costs(const string& in)
 {
+	cerr << "Reading file " << in << "..." << endl;
+	const MappedFile file(in);
+
 	cerr << "Building cost table..." << endl;
 
-	unordered_map<string, float> costs;
-	costs.reserve(data.size() * 3);
-	for (const auto& line : data) {
-		costs[line[2]] = std::stod(line[0]);
+	Costs costs = new_costs();
+	size_t unused_crosses = 0;
+	vector<string_view> fields;
+	for_each_line(file.view(), [&] (const string_view& line) {
+		fields.clear();
+		for_each_field(line, [&] (const string_view& field) { fields.push_back(field); });
+		if (fields.size() < 3) {
+			return;
+		}
+		/* Fields are tab-terminated, which stops strtof/strtoul */
+		const float cost = std::strtof(fields[0].data(), nullptr);
+		if (fields[2] == "*") {
+			/* Default entry of a pruned table (muglearn -D), replaces the unknown-tag penalty */
+			costs.unknown = cost;
+		} else if (!set_cost(costs, fields[2], cost)) {
+			++unused_crosses;
+		}
+	});
+	warn_unused_crosses(in, unused_crosses);
+
+	return costs;
+}
+
+/*
+ * Read a principal component model (muglearn -m pca), which costs actions by
+ * their scores on the components.  Projection and component costs are both
+ * linear, so they are folded into one cost per feature:
+ *
+ *   cost = intercept + sum over c of costs[c] * sum over i of (x_i - mean_i) / scale_i * loading_ic
+ *        = constant + sum over i of x_i * (sum over c of costs[c] * loading_ic / scale_i)
+ *
+ * which scores exactly as the reduced space does, at the price of one lookup
+ * per feature rather than one multiply-add per component.  The constant is
+ * the same for every action, so doesn't affect which is chosen.  Features
+ * which weren't analysed have no component scores, so aren't penalised as
+ * unknown, nor reported.
+ */
+static Costs read_reduced_model(const string& in)
+{
+	cerr << "Reading principal component model " << in << "..." << endl;
+	const MappedFile file(in);
+
+	Costs costs = new_costs();
+	costs.unknown = 0;
+	costs.warn_unknown = false;
+	size_t unused_crosses = 0;
+	size_t k = 0;
+	vector<double> component_costs;
+	vector<string_view> fields;
+	for_each_line(file.view(), [&] (const string_view& line) {
+		fields.clear();
+		for_each_field(line, [&] (const string_view& field) { fields.push_back(field); });
+		if (fields.empty()) {
+			return;
+		}
+		if (fields[0] == "components" && fields.size() >= 2) {
+			k = std::strtoul(fields[1].data(), nullptr, 10);
+		} else if (fields[0] == "costs") {
+			component_costs.clear();
+			for (size_t c = 1; c < fields.size(); ++c) {
+				component_costs.push_back(std::strtod(fields[c].data(), nullptr));
+			}
+		} else if (fields[0] == "feature") {
+			if (fields.size() != 4 + k || component_costs.size() != k) {
+				throw std::runtime_error("Invalid principal component model: " + in);
+			}
+			const double scale = std::strtod(fields[3].data(), nullptr);
+			double cost = 0;
+			for (size_t c = 0; c < k; ++c) {
+				cost += component_costs[c] * std::strtod(fields[4 + c].data(), nullptr);
+			}
+			if (!set_cost(costs, fields[1], cost / scale)) {
+				++unused_crosses;
+			}
+		}
+	});
+	if (k == 0) {
+		throw std::runtime_error("Not a principal component model: " + in);
 	}
+	warn_unused_crosses(in, unused_crosses);
+	cerr << "Folded " << k << " components into costs of " << costs.named.size() << " features" << endl;
 
 	return costs;
 }
 
-static float play_move(mugloar::Game& game, const unordered_map<string, float>& costs, ostream& ss)
+/* Unknown features: cost, and warn user */
+static float unknown_feature(const Costs& costs, const string& feature, ostream& ss, bool& unknown)
 {
-	/* Build list of possible actions and action features */
-	vector<tuple<string, function<void()>, function<void()>, float>> actions;
-	actions.reserve(100);
+	if (!costs.warn_unknown) {
+		return costs.unknown;
+	}
+	if (!unknown) {
+		ss << " * Unknown feature:";
+		unknown = true;
+	}
+	ss << "  [" << feature << "]";
+	return costs.unknown;
+}
 
+/* Calculate total cost of a feature-set */
+template <typename Features>
+static float score_features(const Costs& costs, const Features& features, ostream& ss, bool& unknown)
+{
+	float score = 0;
+	for (const auto& [feature, value] : features) {
+		auto it = costs.named.find(feature);
+		if (it != costs.named.end()) {
+			score += value * it->second;
+		} else {
+			score += unknown_feature(costs, feature, ss, unknown);
+		}
+	}
+	return score;
+}
+
+/* Calculate the game-state part of the cost, shared by every action this turn */
+static float score_state(const Costs& costs, const GameState& state, ostream& ss, bool& unknown)
+{
 	unordered_map<string, float> features;
+	extract_game_state(features, state);
+	features.erase("game:score");
+	features.erase("game:lives");
+	return score_features(costs, features, ss, unknown);
+}
+
+/*
+ * Score all actions of a turn in one batch.
+ *
+ * The state contribution is computed once by the caller, so each action only
+ * costs a lookup per feature of its own, plus one per (capped) cross feature.
+ * Crosses missing from the cost table have zero cost, rather than the unknown
+ * feature penalty, as most of the hash space is never populated.
+ */
+static vector<float> score_actions(const Costs& costs, float state_score, const CrossState& cross_state, const vector<FeatureCache::Value>& action_features, ostream& ss, bool& unknown)
+{
+	vector<float> scores;
+	scores.reserve(action_features.size());
+	CrossFeatures cross;
+	for (const auto& features : action_features) {
+		float score = state_score + score_features(costs, *features, ss, unknown);
+		extract_cross_features(cross, cross_state, *features, max_crosses);
+		for (const auto& [bucket, value] : cross) {
+			score += value * costs.cross[bucket];
+		}
+		scores.push_back(score);
+	}
+	return scores;
+}
+
+static float play_move(mugloar::Game& game, const Costs& costs, ostream& ss)
+{
+	/* Build list of possible actions and action features */
+	vector<pair<string, function<void()>>> actions;
+	vector<FeatureCache::Value> action_features;
+	actions.reserve(100);
+	action_features.reserve(100);
 
 	/* Build action list for solving messages */
 	for (const auto& msg : game.messages()) {
 		actions.push_back({
 			"SOLVE " + msg.message + " FOR " + to_string(int(msg.reward)) + " GOLD",
-			[&] () { game.solve_message(msg); },
-			[&] () { extract_action_features(features, msg); },
-			0
+			[&] () { game.solve_message(msg); }
 			});
+		action_features.push_back(mugloar::action_features(msg));
 	}
 
 	/* Build action list for buying items */
@@ -134,54 +307,35 @@ static float play_move(mugloar::Game& game, const unordered_map<string, float>&
 		}
 		actions.push_back({
 			"BUY " + item.name + " FOR " + to_string(int(item.cost)) + " GOLD",
-			[&] () { game.purchase_item(item); },
-			[&] () { extract_action_features(features, item); },
-			0
+			[&] () { game.purchase_item(item); }
 			});
+		action_features.push_back(mugloar::action_features(item));
+	}
+
+	if (actions.empty()) {
+		throw std::runtime_error("No actions!");
 	}
 
 	auto pre = GameState(game);
 
 	/* Calculate estimated cost for each action */
-
-	typename decltype(actions)::pointer max = nullptr;
 	bool unknown = false;
-	for (auto& action : actions) {
-		auto& [name, execute, get_features, score] = action;
-		score = 0;
-		/* Build feature set */
-		features.clear();
-		extract_game_state(features, pre);
-		features.erase("game:score");
-		features.erase("game:lives");
-		get_features();
-		/* Calculate total cost of features */
-		for (const auto& [feature, value] : features) {
-			auto it = costs.find(feature);
-			if (it != costs.end()) {
-				score += value * it->second;
-			} else {
-				if (!unknown) {
-					/* Unknown features: warn user */
-					ss << " * Unknown feature:";
-					unknown = true;
-				}
-				ss << "  [" << feature << "]";
-				score += -5;
-			}
-		}
-		if (max == nullptr || score > std::get<3>(*max)) {
-			max = &action;
-		}
-	}
+	const auto state_score = score_state(costs, pre, ss, unknown);
+	const CrossState cross_state(pre);
+	const auto scores = score_actions(costs, state_score, cross_state, action_features, ss, unknown);
 	if (unknown) {
 		ss << endl;
 	}
 
-	if (max == nullptr) {
-		throw std::runtime_error("No actions!");
-	}
-	const auto& [name, execute, get_features, max_score] = *max;
+	const size_t best = std::max_element(scores.begin(), scores.end()) - scores.begin();
+	const auto& [name, execute] = actions[best];
+	const auto max_score = scores[best];
+
+	/*
+	 * Keep hold of the chosen action's features, executing the action
+	 * replaces the message list that the action refers to
+	 */
+	const auto chosen_features = action_features[best];
 
 	/* Log move summary */
 	ss << Strong(Magenta("Action chosen:")) << " cost=" << Emph(max_score) << " name=" << Emph(name) << endl;
@@ -193,14 +347,18 @@ static float play_move(mugloar::Game& game, const unordered_map<string, float>&
 
 	auto diff = post - pre;
 
-	/* Rebuild feature set */
-	features.clear();
+	/* Build feature set for the log */
+	unordered_map<string, float> features;
 	extract_game_state(features, pre);
-	get_features();
+	for (const auto& [feature, value] : *chosen_features) {
+		features[feature] = value;
+	}
 	extract_game_diff_state(features, diff);
+	CrossFeatures cross;
+	extract_cross_features(cross, cross_state, *chosen_features, max_crosses);
 
 	/* Log features and changes */
-	log_event(events, game, features);
+	log_event(*events, game, features, cross);
 
 	return max_score;
 
@@ -241,17 +399,17 @@ static void worker_task(const Costs& costs, bool ignore_reputation)
 		if (ignore_reputation) {
 			game.autoupdate_reputation = false;
 		}
+		const auto started = steady_clock::now();
 		try {
 			play_game(game, costs);
 		} catch (const std::runtime_error& e) {
 			cerr << "Worker #" << worker_id << ": error: " << e.what() << endl;
 		}
+		const std::chrono::duration<double> wall_time = steady_clock::now() - started;
 
 		/* Log game result */
 		{
-			stringstream ss;
-			ss << "id=" << game.id() << "\tscore=" << int(game.score()) << "\tturns=" << int(game.turn()) << "\tlevel=" << int(game.level()) << "\tlives=" << int(game.lives()) << "\t" << endl << flush;
-			auto str = ss.str();
+			const auto str = format_score(ScoreRecord(game, wall_time.count()));
 
 			scoped_lock lock(io_mutex);
 			cerr << str;
@@ -264,11 +422,18 @@ static void worker_task(const Costs& costs, bool ignore_reputation)
 static void help()
 {
 	cerr << "Arguments:" << endl;
-	cerr << "  -i input-filename" << endl;
+	cerr << "  -i input-filename (feature costs from muglearn)" << endl;
+	cerr << "  -P pca-model-filename (instead of -i: principal component model from muglearn -m pca)" << endl;
 	cerr << "  -o output-filename" << endl;
+	cerr << "  -b (write binary event log)" << endl;
+	cerr << "  -w (write a shard per worker, output-filename is a directory)" << endl;
+	cerr << "  -d event-log-durability (write|sync, default: write)" << endl;
+	cerr << "  -I (keep a trajectory index of the text event log, see mugindex)" << endl;
+	cerr << "  -R sample-size (only keep a sample of this many events per action/probability/turn stratum)" << endl;
 	cerr << "  -s score-filename" << endl;
 	cerr << "  -p worker-count" << endl;
 	cerr << "  -r (to ignore reputation)" << endl;
+	cerr << "  -x max-cross-features (default: 0, disabled)" << endl;
 }
 
 int main(int argc, char *argv[])
@@ -276,41 +441,51 @@ int main(int argc, char *argv[])
 	init_locale();
 
 	const char *infilename = nullptr;
+	const char *pcafilename = nullptr;
 	const char *outfilename = nullptr;
+	EventLog::Options log_options;
 	const char *scorefilename = nullptr;
 	int worker_count = 20;
 	bool ignore_reputation = false;
 
 	char c;
-	while ((c = getopt(argc, argv, "hi:o:s:p:r")) != -1) {
+	while ((c = getopt(argc, argv, "hi:P:o:s:p:rx:bwd:IR:")) != -1) {
 		switch (c) {
 		case 'h': help(); return 1;
 		case 'i': infilename = optarg; break;
+		case 'P': pcafilename = optarg; break;
 		case 'o': outfilename = optarg; break;
+		case 'b': log_options.binary = true; break;
+		case 'w': log_options.sharded = true; break;
+		case 'd': log_options.durability = parse_durability(optarg); break;
+		case 'I': log_options.index = true; break;
+		case 'R': log_options.sample_size = std::stoul(optarg); break;
 		case 's': scorefilename = optarg; break;
 		case 'p': worker_count = std::stoi(optarg); break;
 		case 'r': ignore_reputation = true; break;
+		case 'x': max_crosses = std::stoul(optarg); break;
 		case '?': help(); return 1;
 		}
 	}
 
-	if (!infilename || !outfilename || !scorefilename || worker_count <= 0 || optind != argc) {
+	if (!infilename == !pcafilename || !outfilename || !scorefilename || worker_count <= 0 || optind != argc) {
 		help();
 		return 1;
 	}
 
 	/* Load feature cost data */
 
-	const auto raw_data = read_file(infilename);
-
-	const auto costs = read_costs(raw_data);
+	const auto costs = infilename ? read_costs(infilename) : read_reduced_model(pcafilename);
 
 	/* Open output files */
 
-	events = ofstream(outfilename, std::ios::binary | std::ios_base::app);
+	events = std::make_unique<EventLog>(outfilename, log_options);
 	scores = ofstream(scorefilename, std::ios::binary | std::ios_base::app);
 
 	/* Create workers */
 	run_parallel(worker_count, [&] () { worker_task(costs, ignore_reputation); });
 
+	action_feature_cache().print_stats(cerr);
+	cerr << endl;
+
 }
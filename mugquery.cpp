@@ -0,0 +1,662 @@
+/*
+ * Filter / group-by / aggregate queries over the event log, e.g. success rate
+ * of tasks by probability and level:
+ *
+ *   mugquery -i training.dat -w action:solve -g 'probability:*' -g game:level \
+ *            -a events -a 'rate(diff:lives>=0)' -a 'mean(diff:score)'
+ *
+ * Events of a sampled log stand for "meta:weight" events each (1 if absent),
+ * and every aggregate but count (of the events logged) is weighted by it.
+ *
+ * The log is split into chunks which are scanned in parallel.  Each chunk is
+ * projected, a batch of events at a time, into columns of just the tags that
+ * the query refers to, and filters and aggregates then run as tight loops over
+ * those columns.  Per-chunk results are merged in log order.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <getopt.h>
+
+#include "ExtractFeatures.hpp"
+#include "Locale.hpp"
+#include "LogReader.hpp"
+#include "Parallel.hpp"
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::unordered_map;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::uint32_t;
+using namespace mugloar;
+
+/* Events projected into columns at a time */
+static constexpr size_t batch_size = 1024;
+
+/* Test on a tag: present, or present and compared to a number */
+struct Condition
+{
+	enum Op { PRESENT, EQ, NE, LT, LE, GT, GE };
+
+	string tag;
+	Op op = PRESENT;
+	float value = 0;
+	size_t slot = 0;
+};
+
+/* Part of the group key */
+struct GroupBy
+{
+	enum Kind {
+		/* Value of a tag, optionally bucketed (e.g. "game:turn/10") */
+		VALUE,
+		/* Name of the tag with given prefix (e.g. "probability:*") */
+		PREFIX,
+		/* The action's name/description words (e.g. the item bought) */
+		WORDS
+	};
+
+	string name;
+	Kind kind = VALUE;
+	string tag;
+	float bucket = 0;
+	size_t slot = 0;
+};
+
+struct Aggregate
+{
+	/* COUNT: events logged, EVENTS: events played that they stand for */
+	enum Kind { COUNT, EVENTS, SUM, MEAN, MIN, MAX, RATE };
+
+	string name;
+	Kind kind = COUNT;
+	/* Input tag of SUM/MEAN/MIN/MAX, or condition of RATE */
+	Condition arg;
+};
+
+struct Query
+{
+	vector<Condition> filters;
+	vector<GroupBy> groups;
+	vector<Aggregate> aggregates;
+
+	/* Tags read into columns, and their column indices */
+	vector<string> slot_tags;
+	unordered_map<string_view, size_t> slots;
+
+	vector<size_t> prefix_groups;
+	bool words = false;
+	size_t weight_slot = 0;
+
+	size_t add_slot(const string& tag)
+	{
+		auto it = std::find(slot_tags.begin(), slot_tags.end(), tag);
+		if (it != slot_tags.end()) {
+			return it - slot_tags.begin();
+		}
+		slot_tags.push_back(tag);
+		return slot_tags.size() - 1;
+	}
+
+	/* Assign columns, once all clauses have been added */
+	void prepare()
+	{
+		for (auto& filter : filters) {
+			filter.slot = add_slot(filter.tag);
+		}
+		for (size_t i = 0; i < groups.size(); ++i) {
+			auto& group = groups[i];
+			if (group.kind == GroupBy::VALUE) {
+				group.slot = add_slot(group.tag);
+			} else if (group.kind == GroupBy::PREFIX) {
+				prefix_groups.push_back(i);
+			} else {
+				words = true;
+			}
+		}
+		for (auto& aggregate : aggregates) {
+			if (aggregate.kind != Aggregate::COUNT && aggregate.kind != Aggregate::EVENTS) {
+				aggregate.arg.slot = add_slot(aggregate.arg.tag);
+			}
+		}
+		weight_slot = add_slot(meta_weight);
+		/* Views into slot_tags, which doesn't change any more */
+		for (size_t i = 0; i < slot_tags.size(); ++i) {
+			slots.emplace(slot_tags[i], i);
+		}
+	}
+};
+
+/* Whole text as a number */
+static float parse_number(const string& text, const string& context)
+{
+	size_t end = 0;
+	float value = 0;
+	try {
+		value = std::stof(text, &end);
+	} catch (const std::logic_error&) {
+	}
+	if (end == 0 || end != text.size()) {
+		throw std::runtime_error("Invalid number in " + context);
+	}
+	return value;
+}
+
+/* Parse "tag", or "tag<op>number" with <op> one of = != < <= > >= */
+static Condition parse_condition(const string& text)
+{
+	Condition cond;
+	const auto pos = text.find_first_of("=!<>");
+	cond.tag = text.substr(0, pos);
+	if (cond.tag.empty()) {
+		throw std::runtime_error("Invalid condition: " + text);
+	}
+	if (pos == string::npos) {
+		return cond;
+	}
+	auto rest = text.substr(pos);
+	static const vector<std::pair<string, Condition::Op>> ops = {
+		{ "!=", Condition::NE }, { "<=", Condition::LE }, { ">=", Condition::GE },
+		{ "=", Condition::EQ }, { "<", Condition::LT }, { ">", Condition::GT }
+	};
+	for (const auto& [name, op] : ops) {
+		if (rest.compare(0, name.size(), name) == 0) {
+			cond.op = op;
+			rest = rest.substr(name.size());
+			break;
+		}
+	}
+	if (cond.op == Condition::PRESENT) {
+		throw std::runtime_error("Invalid condition: " + text);
+	}
+	cond.value = parse_number(rest, "condition: " + text);
+	return cond;
+}
+
+/* Parse "words", "prefix*", "tag" or "tag/bucket-width" */
+static GroupBy parse_group(const string& text)
+{
+	GroupBy group;
+	group.name = text;
+	if (text == "words") {
+		group.kind = GroupBy::WORDS;
+	} else if (!text.empty() && text.back() == '*') {
+		group.kind = GroupBy::PREFIX;
+		group.tag = text.substr(0, text.size() - 1);
+	} else {
+		const auto slash = text.find('/');
+		group.tag = text.substr(0, slash);
+		if (slash != string::npos) {
+			group.bucket = parse_number(text.substr(slash + 1), "group: " + text);
+			if (!(group.bucket > 0)) {
+				throw std::runtime_error("Invalid bucket width: " + text);
+			}
+		}
+	}
+	if (group.kind != GroupBy::WORDS && group.tag.empty()) {
+		throw std::runtime_error("Invalid group: " + text);
+	}
+	return group;
+}
+
+/* Parse "count", "events", or "function(argument)" */
+static Aggregate parse_aggregate(const string& text)
+{
+	Aggregate aggregate;
+	aggregate.name = text;
+	if (text == "count") {
+		return aggregate;
+	}
+	if (text == "events") {
+		aggregate.kind = Aggregate::EVENTS;
+		return aggregate;
+	}
+	const auto open = text.find('(');
+	if (open == string::npos || text.back() != ')') {
+		throw std::runtime_error("Invalid aggregate: " + text);
+	}
+	const auto func = text.substr(0, open);
+	const auto arg = text.substr(open + 1, text.size() - open - 2);
+	static const unordered_map<string, Aggregate::Kind> kinds = {
+		{ "sum", Aggregate::SUM }, { "mean", Aggregate::MEAN },
+		{ "min", Aggregate::MIN }, { "max", Aggregate::MAX },
+		{ "rate", Aggregate::RATE }
+	};
+	auto it = kinds.find(func);
+	if (it == kinds.end()) {
+		throw std::runtime_error("Unknown aggregate function: " + func);
+	}
+	aggregate.kind = it->second;
+	if (aggregate.kind == Aggregate::RATE) {
+		aggregate.arg = parse_condition(arg);
+	} else {
+		aggregate.arg.tag = arg;
+	}
+	if (aggregate.arg.tag.empty()) {
+		throw std::runtime_error("Invalid aggregate: " + text);
+	}
+	return aggregate;
+}
+
+/* Accumulator of one aggregate of one group */
+struct Acc
+{
+	double sum = 0;
+	double count = 0;
+	float min = std::numeric_limits<float>::infinity();
+	float max = -std::numeric_limits<float>::infinity();
+
+	void merge(const Acc& other)
+	{
+		sum += other.sum;
+		count += other.count;
+		min = std::min(min, other.min);
+		max = std::max(max, other.max);
+	}
+};
+
+/* Groups found so far, with an accumulator per aggregate (plus one for matching rows) */
+struct Groups
+{
+	vector<string> keys;
+	unordered_map<string, uint32_t> ids;
+	vector<Acc> acc;
+	size_t width;
+
+	Groups(const Query& query) : width(query.aggregates.size() + 1) { }
+
+	uint32_t id(const string& key)
+	{
+		auto it = ids.find(key);
+		if (it != ids.end()) {
+			return it->second;
+		}
+		const uint32_t id = keys.size();
+		keys.push_back(key);
+		ids.emplace(key, id);
+		acc.resize(acc.size() + width);
+		return id;
+	}
+
+	Acc *row(uint32_t id) { return &acc[id * width]; }
+
+	void merge(const Groups& other)
+	{
+		for (size_t i = 0; i < other.keys.size(); ++i) {
+			auto *dst = row(id(other.keys[i]));
+			const auto *src = &other.acc[i * width];
+			for (size_t a = 0; a < width; ++a) {
+				dst[a].merge(src[a]);
+			}
+		}
+	}
+};
+
+/* Columns of a batch of events */
+struct Batch
+{
+	size_t size = 0;
+	/* [slot][row] */
+	vector<vector<float>> values;
+	vector<vector<float>> present;
+	vector<uint32_t> group;
+	vector<float> mask;
+	/* mask times the row's meta:weight */
+	vector<float> weight;
+	vector<float> test;
+
+	Batch(const Query& query) :
+		values(query.slot_tags.size(), vector<float>(batch_size)),
+		present(query.slot_tags.size(), vector<float>(batch_size)),
+		group(batch_size),
+		mask(batch_size),
+		weight(batch_size),
+		test(batch_size)
+	{
+	}
+};
+
+/* test[r] = 1 where the condition holds, else 0 */
+static void evaluate(const Condition& cond, const Batch& batch, vector<float>& test)
+{
+	const auto n = batch.size;
+	const float *v = batch.values[cond.slot].data();
+	const float *p = batch.present[cond.slot].data();
+	const float x = cond.value;
+	float *t = test.data();
+	switch (cond.op) {
+	case Condition::PRESENT: for (size_t r = 0; r < n; ++r) t[r] = p[r]; break;
+	case Condition::EQ: for (size_t r = 0; r < n; ++r) t[r] = p[r] * (v[r] == x); break;
+	case Condition::NE: for (size_t r = 0; r < n; ++r) t[r] = p[r] * (v[r] != x); break;
+	case Condition::LT: for (size_t r = 0; r < n; ++r) t[r] = p[r] * (v[r] < x); break;
+	case Condition::LE: for (size_t r = 0; r < n; ++r) t[r] = p[r] * (v[r] <= x); break;
+	case Condition::GT: for (size_t r = 0; r < n; ++r) t[r] = p[r] * (v[r] > x); break;
+	case Condition::GE: for (size_t r = 0; r < n; ++r) t[r] = p[r] * (v[r] >= x); break;
+	}
+}
+
+/* Filter and aggregate a full batch into groups */
+static void aggregate_batch(const Query& query, Batch& batch, Groups& groups)
+{
+	const auto n = batch.size;
+	float *mask = batch.mask.data();
+	std::fill(mask, mask + n, 1.0f);
+	for (const auto& filter : query.filters) {
+		evaluate(filter, batch, batch.test);
+		const float *t = batch.test.data();
+		for (size_t r = 0; r < n; ++r) {
+			mask[r] *= t[r];
+		}
+	}
+
+	/* Events that each matching row stands for */
+	float *weight = batch.weight.data();
+	{
+		const float *p = batch.present[query.weight_slot].data();
+		const float *v = batch.values[query.weight_slot].data();
+		for (size_t r = 0; r < n; ++r) {
+			weight[r] = mask[r] * (p[r] != 0 ? v[r] : 1.0f);
+		}
+	}
+
+	const auto *g = batch.group.data();
+	const auto width = groups.width;
+	auto *acc = groups.acc.data();
+
+	/* Matching rows of each group (last accumulator) */
+	for (size_t r = 0; r < n; ++r) {
+		acc[g[r] * width + width - 1].count += mask[r];
+	}
+
+	for (size_t a = 0; a < query.aggregates.size(); ++a) {
+		const auto& aggregate = query.aggregates[a];
+		if (aggregate.kind == Aggregate::COUNT || aggregate.kind == Aggregate::EVENTS) {
+			const float *w = aggregate.kind == Aggregate::COUNT ? mask : weight;
+			for (size_t r = 0; r < n; ++r) {
+				acc[g[r] * width + a].count += w[r];
+			}
+			continue;
+		}
+		if (aggregate.kind == Aggregate::RATE) {
+			evaluate(aggregate.arg, batch, batch.test);
+			const float *t = batch.test.data();
+			for (size_t r = 0; r < n; ++r) {
+				auto& x = acc[g[r] * width + a];
+				x.sum += weight[r] * t[r];
+				x.count += weight[r];
+			}
+			continue;
+		}
+		/* Weight of each row: events it stands for, if it matches and has the tag */
+		float *w = batch.test.data();
+		const float *p = batch.present[aggregate.arg.slot].data();
+		const float *v = batch.values[aggregate.arg.slot].data();
+		for (size_t r = 0; r < n; ++r) {
+			w[r] = weight[r] * p[r];
+		}
+		if (aggregate.kind == Aggregate::SUM || aggregate.kind == Aggregate::MEAN) {
+			for (size_t r = 0; r < n; ++r) {
+				auto& x = acc[g[r] * width + a];
+				x.sum += w[r] * v[r];
+				x.count += w[r];
+			}
+		} else {
+			for (size_t r = 0; r < n; ++r) {
+				if (mask[r] * p[r] != 0) {
+					auto& x = acc[g[r] * width + a];
+					x.min = std::min(x.min, v[r]);
+					x.max = std::max(x.max, v[r]);
+				}
+			}
+		}
+	}
+
+	batch.size = 0;
+	for (size_t s = 0; s < batch.values.size(); ++s) {
+		std::fill(batch.values[s].begin(), batch.values[s].end(), 0.0f);
+		std::fill(batch.present[s].begin(), batch.present[s].end(), 0.0f);
+	}
+}
+
+static void append_number(string& key, float value)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%g", value);
+	key += buf;
+}
+
+/* Run query over one chunk of the log */
+static Groups scan_chunk(const Query& query, const LogReader& log, const LogChunk& chunk)
+{
+	Groups groups(query);
+	Batch batch(query);
+
+	vector<string_view> captured(query.groups.size());
+	vector<string_view> words;
+	string key;
+
+	log.for_each_event(chunk, [&] (const EventView& event) {
+		const auto r = batch.size;
+		std::fill(captured.begin(), captured.end(), string_view());
+		words.clear();
+
+		/* Project the event into the batch's columns */
+		event.for_each_feature([&] (string_view tag, const FieldValue& value) {
+			auto it = query.slots.find(tag);
+			if (it != query.slots.end()) {
+				batch.values[it->second][r] = value;
+				batch.present[it->second][r] = 1;
+			}
+			for (auto i : query.prefix_groups) {
+				const auto& prefix = query.groups[i].tag;
+				if (captured[i].empty() && tag.substr(0, prefix.size()) == prefix) {
+					captured[i] = tag.substr(prefix.size());
+				}
+			}
+			if (query.words && tag.find_first_of(": ") == string_view::npos) {
+				words.push_back(tag);
+			}
+		});
+
+		/* Group key */
+		key.clear();
+		for (size_t i = 0; i < query.groups.size(); ++i) {
+			const auto& group = query.groups[i];
+			if (i > 0) {
+				key += '\t';
+			}
+			switch (group.kind) {
+			case GroupBy::VALUE:
+				if (batch.present[group.slot][r] == 0) {
+					key += '-';
+				} else if (group.bucket > 0) {
+					append_number(key, std::floor(batch.values[group.slot][r] / group.bucket) * group.bucket);
+				} else {
+					append_number(key, batch.values[group.slot][r]);
+				}
+				break;
+			case GroupBy::PREFIX:
+				key += captured[i].empty() ? string_view("-") : captured[i];
+				break;
+			case GroupBy::WORDS:
+				std::sort(words.begin(), words.end());
+				for (size_t j = 0; j < words.size(); ++j) {
+					if (j > 0) {
+						key += ' ';
+					}
+					key += words[j];
+				}
+				break;
+			}
+		}
+		batch.group[r] = groups.id(key);
+
+		if (++batch.size == batch_size) {
+			aggregate_batch(query, batch, groups);
+		}
+	});
+	if (batch.size > 0) {
+		aggregate_batch(query, batch, groups);
+	}
+
+	return groups;
+}
+
+/* Compare tab-separated group keys field by field, numerically where both fields are numbers */
+static bool key_less(const string& a, const string& b)
+{
+	size_t i = 0;
+	size_t j = 0;
+	while (i <= a.size() && j <= b.size()) {
+		auto ea = std::min(a.find('\t', i), a.size());
+		auto eb = std::min(b.find('\t', j), b.size());
+		const auto fa = a.substr(i, ea - i);
+		const auto fb = b.substr(j, eb - j);
+		if (fa != fb) {
+			char *end_a;
+			char *end_b;
+			const double na = std::strtod(fa.c_str(), &end_a);
+			const double nb = std::strtod(fb.c_str(), &end_b);
+			if (!fa.empty() && !fb.empty() && *end_a == '\0' && *end_b == '\0' && na != nb) {
+				return na < nb;
+			}
+			return fa < fb;
+		}
+		i = ea + 1;
+		j = eb + 1;
+	}
+	return a.size() < b.size();
+}
+
+static void print_result(const Query& query, const Groups& groups)
+{
+	vector<uint32_t> order;
+	for (uint32_t id = 0; id < groups.keys.size(); ++id) {
+		/* Groups whose events were all filtered out */
+		if (groups.acc[id * groups.width + groups.width - 1].count > 0) {
+			order.push_back(id);
+		}
+	}
+	std::sort(order.begin(), order.end(), [&] (uint32_t a, uint32_t b) { return key_less(groups.keys[a], groups.keys[b]); });
+
+	string sep;
+	for (const auto& group : query.groups) {
+		cout << sep << group.name;
+		sep = "\t";
+	}
+	for (const auto& aggregate : query.aggregates) {
+		cout << sep << aggregate.name;
+		sep = "\t";
+	}
+	cout << "\n";
+
+	for (auto id : order) {
+		sep.clear();
+		if (!query.groups.empty()) {
+			cout << groups.keys[id];
+			sep = "\t";
+		}
+		const auto *acc = &groups.acc[id * groups.width];
+		for (size_t a = 0; a < query.aggregates.size(); ++a) {
+			const auto& x = acc[a];
+			cout << sep;
+			sep = "\t";
+			switch (query.aggregates[a].kind) {
+			case Aggregate::COUNT: cout << size_t(x.count); break;
+			case Aggregate::EVENTS: cout << size_t(x.count + 0.5); break;
+			case Aggregate::SUM: cout << x.sum; break;
+			case Aggregate::MEAN:
+			case Aggregate::RATE:
+				if (x.count > 0) {
+					cout << x.sum / x.count;
+				} else {
+					cout << "-";
+				}
+				break;
+			case Aggregate::MIN:
+			case Aggregate::MAX:
+				if (x.min <= x.max) {
+					cout << (query.aggregates[a].kind == Aggregate::MIN ? x.min : x.max);
+				} else {
+					cout << "-";
+				}
+				break;
+			}
+		}
+		cout << "\n";
+	}
+}
+
+static void help()
+{
+	cerr << "Arguments:" << endl;
+	cerr << "  -i input-filename (text or binary event log, or shard directory)" << endl;
+	cerr << "  -w condition (only events where tag is present, or tag=x, tag!=x, tag<x, tag<=x, tag>x, tag>=x; may be repeated)" << endl;
+	cerr << "  -g group (tag value, tag/bucket-width, prefix* for the tag with that prefix, or words; may be repeated)" << endl;
+	cerr << "  -a aggregate (events, count, sum(tag), mean(tag), min(tag), max(tag), rate(condition); may be repeated, default: events)" << endl;
+	cerr << "     Aggregates are weighted by meta:weight, the events played that each logged event stands for, but count counts the events logged" << endl;
+	cerr << "  -j thread-count (default: number of CPUs)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	init_locale();
+
+	const char *infilename = nullptr;
+	unsigned thread_count = default_thread_count();
+	Query query;
+	char c;
+	try {
+		while ((c = getopt(argc, argv, "hi:w:g:a:j:")) != -1) {
+			switch (c) {
+			case 'h': help(); return 1;
+			case 'i': infilename = optarg; break;
+			case 'w': query.filters.push_back(parse_condition(optarg)); break;
+			case 'g': query.groups.push_back(parse_group(optarg)); break;
+			case 'a': query.aggregates.push_back(parse_aggregate(optarg)); break;
+			case 'j': thread_count = std::max(1, std::stoi(optarg)); break;
+			case '?': help(); return 1;
+			}
+		}
+	} catch (const std::exception& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	if (!infilename || optind != argc) {
+		help();
+		return 1;
+	}
+
+	if (query.aggregates.empty()) {
+		query.aggregates.push_back(parse_aggregate("events"));
+	}
+	query.prepare();
+
+	cerr << "Reading event log " << infilename << "..." << endl;
+	const LogReader log(infilename);
+
+	const auto chunks = log.chunks(thread_count * 4);
+	vector<Groups> results(chunks.size(), Groups(query));
+	cerr << "Scanning " << chunks.size() << " chunks on " << thread_count << " threads..." << endl;
+	parallel_for(chunks.size(), thread_count, [&] (size_t i) {
+		results[i] = scan_chunk(query, log, chunks[i]);
+	});
+
+	Groups total(query);
+	for (const auto& result : results) {
+		total.merge(result);
+	}
+
+	print_result(query, total);
+}
@@ -0,0 +1,222 @@
+/*
+ * Streaming analysis of the scores file written by mugobasic/mugomatic:
+ * percentiles of score, turns and score per turn, over all games and over
+ * sliding windows of recent games.
+ *
+ * Uses constant memory (t-digests, see TDigest.hpp), so it can follow a
+ * scores file which grows endlessly (-f), like "tail -f".
+ */
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "Locale.hpp"
+#include "ScoreLog.hpp"
+#include "TDigest.hpp"
+
+using std::string;
+using std::vector;
+using std::ifstream;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::setw;
+using std::uint64_t;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+using namespace mugloar;
+
+namespace fs = std::filesystem;
+
+static const char *metric_names[] = { "score", "turns", "score/turn" };
+
+static constexpr size_t metric_count = 3;
+
+/* Digests of each metric over one window */
+struct Window
+{
+	string name;
+	/* 0 = all games */
+	uint64_t length;
+	TDigest all[metric_count];
+	vector<WindowedDigest> recent;
+
+	Window(const string& name, uint64_t length) :
+		name(name),
+		length(length)
+	{
+		if (length > 0) {
+			recent.assign(metric_count, WindowedDigest(length));
+		}
+	}
+
+	void add(uint64_t time, const double (&values)[metric_count], const bool (&valid)[metric_count])
+	{
+		for (size_t m = 0; m < metric_count; ++m) {
+			if (!valid[m]) {
+				continue;
+			}
+			if (length > 0) {
+				recent[m].add(time, values[m]);
+			} else {
+				all[m].add(values[m]);
+			}
+		}
+	}
+
+	void print(uint64_t now)
+	{
+		for (size_t m = 0; m < metric_count; ++m) {
+			TDigest digest;
+			if (length > 0) {
+				recent[m].advance(now);
+				digest = recent[m].digest();
+			} else {
+				digest = all[m];
+			}
+			cout << setw(8) << name << setw(12) << metric_names[m] << setw(10) << size_t(digest.count());
+			if (digest.count() > 0) {
+				for (const auto x : { digest.mean(), digest.quantile(0.5), digest.quantile(0.9), digest.quantile(0.99), digest.max() }) {
+					cout << setw(12) << x;
+				}
+			}
+			cout << "\n";
+		}
+	}
+};
+
+static uint64_t now_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+static void report(vector<Window>& windows)
+{
+	const auto now = now_us();
+	cout << setw(8) << "window" << setw(12) << "metric" << setw(10) << "games";
+	for (const auto *name : { "mean", "p50", "p90", "p99", "max" }) {
+		cout << setw(12) << name;
+	}
+	cout << "\n";
+	for (auto& window : windows) {
+		window.print(now);
+	}
+	cout << endl;
+}
+
+static void help()
+{
+	cerr << "Arguments:" << endl;
+	cerr << "  -i scores-filename" << endl;
+	cerr << "  -w window-seconds (sliding window of recent games, may be repeated, default: 3600)" << endl;
+	cerr << "  -f (follow the file as it grows, until interrupted)" << endl;
+	cerr << "  -r report-interval-seconds (when following, default: 10)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	init_locale();
+
+	const char *infilename = nullptr;
+	vector<uint64_t> window_seconds;
+	bool follow = false;
+	unsigned report_interval = 10;
+	char c;
+	while ((c = getopt(argc, argv, "hi:w:fr:")) != -1) {
+		switch (c) {
+		case 'h': help(); return 1;
+		case 'i': infilename = optarg; break;
+		case 'w': window_seconds.push_back(std::stoull(optarg)); break;
+		case 'f': follow = true; break;
+		case 'r': report_interval = std::stoul(optarg); break;
+		case '?': help(); return 1;
+		}
+	}
+
+	if (!infilename || optind != argc) {
+		help();
+		return 1;
+	}
+
+	if (window_seconds.empty()) {
+		window_seconds.push_back(3600);
+	}
+	vector<Window> windows;
+	windows.emplace_back("all", 0);
+	for (const auto s : window_seconds) {
+		windows.emplace_back(std::to_string(s) + "s", s * 1000000);
+	}
+
+	ifstream in(infilename, std::ios::binary);
+	if (!in) {
+		cerr << "Failed to open scores file " << infilename << endl;
+		return 1;
+	}
+
+	size_t records = 0;
+	size_t invalid = 0;
+	string line;
+	/* Start of a line which hasn't been completely written yet */
+	string pending;
+	auto next_report = steady_clock::now() + std::chrono::seconds(report_interval);
+	while (true) {
+		if (std::getline(in, line)) {
+			if (in.eof()) {
+				pending += line;
+				continue;
+			}
+			if (!pending.empty()) {
+				line.insert(0, pending);
+				pending.clear();
+			}
+			ScoreRecord record;
+			if (!parse_score(line, record)) {
+				++invalid;
+				continue;
+			}
+			/* Older records have no timestamp: count them as finished now */
+			const auto time = record.time ? record.time : now_us();
+			const double values[metric_count] = { record.score, record.turns, record.turns > 0 ? record.score / record.turns : 0 };
+			const bool valid[metric_count] = { true, true, record.turns > 0 };
+			for (auto& window : windows) {
+				window.add(time, values, valid);
+			}
+			++records;
+			continue;
+		}
+
+		/* End of file */
+		if (!follow) {
+			break;
+		}
+		if (steady_clock::now() >= next_report) {
+			cerr << "Games: " << records << endl;
+			report(windows);
+			next_report = steady_clock::now() + std::chrono::seconds(report_interval);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		in.clear();
+		/* File was truncated (or replaced): start again from its beginning */
+		std::error_code ec;
+		const auto size = fs::file_size(infilename, ec);
+		if (!ec && size < uint64_t(in.tellg())) {
+			cerr << "Scores file shrank, reading it from the start" << endl;
+			in.close();
+			in.open(infilename, std::ios::binary);
+			pending.clear();
+		}
+	}
+
+	cerr << "Games: " << records << endl;
+	if (invalid) {
+		cerr << "Invalid lines: " << invalid << endl;
+	}
+	report(windows);
+}